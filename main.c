@@ -1,17 +1,35 @@
 // Compile with: gcc main.c -o main $(sdl2-config --cflags --libs) -lSDL2_image
+// or, without a window and without SDL: gcc -DHEADLESS main.c -o main -lpthread
 
 #include <stdio.h>
 #include <ctype.h>
-#include <SDL2/SDL.h>
 #include <stdbool.h>
+#ifndef HEADLESS
+#include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
+#endif
 #include <pthread.h>
 #include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 // Board and cell size
 #define WINDOW_SIZE 960
 #define CELL_SIZE 120
 
+#define START_FEN "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+#define MAX_FEN 100 // longest FEN toFEN() writes, with its terminator
+
 // Pieces
 enum PieceType
 {
@@ -37,148 +55,696 @@ struct coordinate
     int y;
 };
 
-// Piece structure
-struct piece
+// Bitboards: bit (row * 8 + col) is set when that square holds the piece/colour.
+// Kept in sync with board through setSquare()/clearSquare().
+typedef uint64_t Bitboard;
+
+#define SQUARE(row, col) ((row) * 8 + (col))
+#define BIT(sq) (1ULL << (sq))
+
+#define MAX_MOVES 256
+#define MAX_PLY 256
+
+// A move packed into 16 bits: from square, to square and a MoveFlag
+typedef uint16_t Move;
+
+enum MoveFlag
+{
+    QUIET,
+    DOUBLE_PUSH,
+    CASTLE, // king moves two columns, the rook jumps over it
+    EN_PASSANT,
+    PROMO_R, // promotions follow the order of the PieceTypes they create
+    PROMO_N,
+    PROMO_B,
+    PROMO_Q
+};
+
+#define MOVE(from, to, flag) ((Move)((from) | ((to) << 6) | ((flag) << 12)))
+#define MOVE_FROM(m) ((m) & 63)
+#define MOVE_TO(m) (((m) >> 6) & 63)
+#define MOVE_FLAG(m) ((m) >> 12)
+
+// Castling rights bits
+#define WHITE_RIGHT 1 // white king side
+#define WHITE_LEFT 2  // white queen side
+#define BLACK_RIGHT 4
+#define BLACK_LEFT 8
+
+// Moves generated for one position. Lives on the caller's stack, so nested
+// generation (e.g. inside a search) never clobbers an outer list.
+struct moveList
+{
+    Move moves[MAX_MOVES];
+    int count;
+};
+
+// What unmake_move needs to restore after make_move
+struct undo
+{
+    Move move;
+    uint8_t captured;  // PieceType taken (on to, or behind it en passant), NONE if nothing
+    uint8_t castling;  // GameState.castling before the move
+    int8_t ep_square;  // GameState.ep_square before the move
+    uint16_t halfmove; // GameState.halfmove before the move
+    uint64_t key;      // GameState.key before the move
+};
+
+// Everything the rules code reads and writes. Every function takes the state it
+// works on, so independent games and searches can run concurrently.
+struct GameState
+{
+    // Backend board representation: the PieceType on each square, NONE if empty
+    uint8_t board[64];
+
+    Bitboard piece_bb[12];  // one per PieceType
+    Bitboard color_bb[2];   // indexed by piece color (1 = white, 0 = black)
+    Bitboard occupied_bb;   // every occupied square
+
+    int side;          // color to move
+    uint8_t castling;  // WHITE_RIGHT | WHITE_LEFT | BLACK_RIGHT | BLACK_LEFT
+    int8_t ep_square;  // square behind a pawn that just moved two squares, -1 if none
+    uint16_t halfmove; // plies since the last capture or pawn move
+    uint16_t fullmove; // starts at 1, incremented after black moves
+    uint64_t key;      // Zobrist key, kept up to date by every board change
+    uint64_t pawn_key; // Zobrist key of the pawns alone, for the pawn table
+
+    // Evaluation terms, kept up to date by every board change like key
+    int mg_score; // midgame material + piece-square sum, white minus black
+    int eg_score; // endgame material + piece-square sum, white minus black
+    int phase;    // sum of phase_weight over the board, 24 at the start
+
+    // one entry per move made and not yet unmade
+    struct undo undo_stack[MAX_PLY];
+    int ply;
+
+    // keys of the game positions before undo_stack[0], oldest first, back to
+    // the last capture or pawn move: the ones a repetition can go back to
+    uint64_t history[MAX_PLY];
+    int history_len;
+};
+
+#define MAX_DEPTH 64
+#define INF_SCORE 32000
+#define MATE_SCORE 31000 // mate in n plies scores MATE_SCORE - n
+
+// Budget for one search; 0 leaves that limit off
+struct searchLimits
+{
+    int depth;
+    int movetime_ms;
+    uint64_t nodes;    // per search thread
+    atomic_bool *stop; // if set, raised by another thread to end the search early
+    bool info;         // print a UCI info line after every iteration
+};
+
+// Selective search techniques, all on by default. Set before a search starts
+// (command line, UCI setoption) and only read while it runs.
+struct searchOptions
+{
+    bool null_move;  // null-move pruning
+    bool lmr;        // late-move reductions
+    bool pvs;        // principal variation search
+    bool aspiration; // aspiration windows at the root
+    bool futility;   // futility pruning at frontier nodes
+};
+
+struct searchOptions search_options = {true, true, true, true, true};
+
+enum Bound
+{
+    BOUND_NONE,
+    BOUND_UPPER, // every move failed low, score is at most this
+    BOUND_LOWER, // a move failed high, score is at least this
+    BOUND_EXACT
+};
+
+// A transposition table result, unpacked from a ttSlot
+struct ttEntry
 {
-    struct coordinate coord;
-    enum PieceType recog;
-    int moved;
-    int castled;
-    int doubleMove;
-    int color; // 1 = white, 0 = black
+    Move move;
+    int16_t score;
+    uint8_t depth;
+    uint8_t bound;
 };
 
-// Backend board representation
-struct piece board[8][8];
-bool attack_map[8][8] = {0};
+// Shared between search threads without locks, like the perft hash: check
+// holds key ^ data, so a slot torn by two writers fails verification.
+struct ttSlot
+{
+    _Atomic uint64_t check;
+    _Atomic uint64_t data; // ttEntry packed as move | score << 16 | depth << 32 | bound << 40
+};
+
+// Search results by position key, a power of two number of slots
+struct transTable
+{
+    struct ttSlot *slots;
+    uint64_t mask;
+};
+
+#define PAWN_TABLE_SIZE 2048 // entries, a power of two
+
+// Pawn structure terms of one pawn configuration, per color. The king shield
+// also depends on where the king stands, so it is kept with that square.
+struct pawnEntry
+{
+    uint64_t key;       // GameState.pawn_key
+    int16_t mg[2];      // doubled, isolated, backward and passed pawns
+    int16_t eg[2];
+    int16_t shield[2];  // midgame only
+    int8_t king_sq[2];  // the shield was computed for, -1 if not yet
+};
+
+// Private to a search thread, so entries are read and written without care
+struct pawnTable
+{
+    struct pawnEntry entries[PAWN_TABLE_SIZE];
+    uint64_t probes;
+    uint64_t hits;
+};
+
+// One search thread. It owns a private copy of the position, so any number
+// of searches can run at once without touching the game's board.
+struct searchContext
+{
+    struct GameState pos;
+    struct searchLimits limits;
+    struct transTable *tt; // may be NULL, shared by all threads of a search
+    struct timespec start;
+    uint64_t nodes;
+    _Atomic uint64_t *all_nodes; // nodes of all threads, added in batches of 1024
+    _Atomic uint64_t all_nodes_count; // what all_nodes points to on thread 0
+    int id;              // 0 for the thread whose result is played
+    atomic_bool *stop;   // shared by all threads of a search
+    atomic_bool stop_flag; // what stop points to on thread 0
+    bool stopped;        // this thread has seen stop mid-iteration
+
+    Move best_move;  // from the last completed iteration
+    int best_score;
+    int depth_done;
+    Move root_best;  // best root move of the iteration in progress
+
+    // move ordering memory, private to the thread
+    Move killers[MAX_PLY][2];  // quiet moves that last cut off at each ply
+    int history[2][64][64];    // by side, from, to: how often a quiet move cut off
+
+    // nodes that failed high, and how many of those on their first move
+    uint64_t cutoffs;
+    uint64_t first_move_cutoffs;
+    uint64_t moves_generated; // by the move pickers, to measure lazy generation
+    uint64_t qnodes;          // part of nodes spent in quiescence search
+    uint64_t see_pruned;      // captures quiescence skipped as losing
+
+    struct pawnTable pawns;
+};
+
+// A game played in the window: the position plus who controls each side
+struct game
+{
+    struct GameState pos;
+    bool engine[2];             // indexed by color, true when the engine plays that side
+    struct searchLimits limits; // budget for every engine move
+    struct transTable tt;       // kept between moves
+    int threads;                // search threads per engine move
+};
+
+static inline int popcount(Bitboard b)
+{
+    return __builtin_popcountll(b);
+}
+
+// index of the least significant set bit, b must be non-zero
+static inline int lsb(Bitboard b)
+{
+    return __builtin_ctzll(b);
+}
+
+// remove and return the least significant set bit
+static inline int popLsb(Bitboard *b)
+{
+    int sq = __builtin_ctzll(*b);
+    *b &= *b - 1;
+    return sq;
+}
+
+// 1 for a white PieceType, 0 for black; p must not be NONE
+static inline int pieceColor(int p)
+{
+    return p <= WK;
+}
+
+// PieceType a PROMO_* flag turns a pawn of color into
+static inline int promoPiece(int flag, int color)
+{
+    return flag - PROMO_R + (color ? WR : BR);
+}
 
+#ifndef HEADLESS
 // Piece textures
 SDL_Texture *pieceTextures[12];
+#endif
 
-int init();
-int print_board(struct piece board[8][8]);
+int init(struct GameState *gs);
+int print_board(const uint8_t board[64]);
+#ifndef HEADLESS
 SDL_Texture *loadTexture(SDL_Renderer *renderer, const char *path);
 void drawPiece(SDL_Renderer *renderer, SDL_Texture *texture, int row, int col);
-int getTextureIndex(struct piece p);
-void input(char turn, struct coordinate move[2]);
+int getTextureIndex(uint8_t piece);
+#endif
+char input(char turn, struct coordinate move[2]);
 void convertToCoord(char coord[], struct coordinate move[2]);
-void moveValidity(struct coordinate move[], bool AMCall);
-void movePawn(struct coordinate move[], bool AMCall);
-struct coordinate generateAM(struct coordinate move[], int attacker_color);
-void moveKing(struct coordinate move[]);
-void moveQueen(struct coordinate move[]);
-void moveBishop(struct coordinate move[]);
-void moveKnight(struct coordinate move[]);
-void moveRook(struct coordinate move[]);
-void increaseSizeMoveset();
+void moveValidity(struct GameState *gs, int from, Bitboard allowed, struct moveList *list);
+void movePawn(struct GameState *gs, int from, Bitboard allowed, struct moveList *list);
+void moveKing(struct GameState *gs, int from, Bitboard allowed, struct moveList *list);
+void moveQueen(struct GameState *gs, int from, Bitboard allowed, struct moveList *list);
+void moveBishop(struct GameState *gs, int from, Bitboard allowed, struct moveList *list);
+void moveKnight(struct GameState *gs, int from, Bitboard allowed, struct moveList *list);
+void moveRook(struct GameState *gs, int from, Bitboard allowed, struct moveList *list);
+static inline void setSquare(struct GameState *gs, int sq, int piece);
+static inline void clearSquare(struct GameState *gs, int sq);
 
 // prototypes for castling helpers (needed because run() calls them)
-bool canCastle(int color, char side);
-void doCastle(int color, char side);
+bool canCastle(struct GameState *gs, int color, char side);
+
+void make_move(struct GameState *gs, Move m);
+void unmake_move(struct GameState *gs);
+void commitMove(struct GameState *gs, Move m);
+bool kingInCheck(struct GameState *gs, int color);
+int generateLegal(struct GameState *gs, struct moveList *list);
 
+int loadFEN(struct GameState *gs, const char *fen);
+void toFEN(const struct GameState *gs, char out[MAX_FEN]);
+void moveToString(Move m, char out[6]);
+Move searchBestMove(struct searchContext *ctx, const struct GameState *gs, const struct searchLimits *limits, struct transTable *tt, int threads);
+uint64_t positionKey(struct GameState *gs);
+uint64_t pawnKey(struct GameState *gs);
+static int64_t elapsedMs(const struct searchContext *ctx);
 
-// moveset coordinate array
-struct coordinate *moveset;
-// position to store at moveset
-int pos = 0;
-// track how many elements allocated
-int moveset_capacity = 1;
 
-//put coordinate in moveset
-void putMoveset(struct coordinate coord)
+// add a move from from to every square set in targets
+static inline void putMoveBits(struct moveList *list, int from, Bitboard targets)
 {
-    if (pos >= moveset_capacity)
-        increaseSizeMoveset();
+    while (targets)
+        list->moves[list->count++] = MOVE(from, popLsb(&targets), QUIET);
+}
 
-    moveset[pos] = coord;
-    pos++;
+// add a pawn move, once per promotion piece when it reaches the last row
+static inline void putPawnMove(struct moveList *list, int from, int to)
+{
+    if (to < 8 || to >= 56)
+    {
+        for (int flag = PROMO_Q; flag >= PROMO_R; flag--)
+            list->moves[list->count++] = MOVE(from, to, flag);
+    }
+    else
+        list->moves[list->count++] = MOVE(from, to, QUIET);
 }
 
-// increase size of moveset
-void increaseSizeMoveset()
+/*-------------------------- BITBOARD HELPERS --------------------------*/
+
+// Zobrist keys: a position hashes to the XOR of the keys of its features
+uint64_t zobrist_piece[12][64];
+uint64_t zobrist_castle[4]; // one per castling rights bit
+uint64_t zobrist_ep[8];     // column of the en-passant square
+uint64_t zobrist_side;      // white to move
+
+// Material plus piece-square value of each piece on each square, white positive,
+// filled by initEval()
+int eval_mg[12][64];
+int eval_eg[12][64];
+
+// Contribution of each piece to the game phase: minors 1, rooks 2, queens 4
+static const int phase_weight[12] = {0, 2, 1, 1, 4, 0, 0, 2, 1, 1, 4, 0};
+
+// XOR of the keys of every castling right set in rights
+static inline uint64_t castleKey(int rights)
 {
-    moveset_capacity *= 2;
-    moveset = realloc(moveset, moveset_capacity * sizeof(struct coordinate));
+    uint64_t key = 0;
+    for (int i = 0; i < 4; i++)
+        if (rights & (1 << i))
+            key ^= zobrist_castle[i];
+    return key;
 }
 
-//clear all the values in moveset
-void clearMoveset()
+// Place a piece on a square, keeping the bitboards in sync with board
+static inline void setSquare(struct GameState *gs, int sq, int piece)
 {
-    // don't shrink the allocated buffer every clear — just reset position
-    pos = 0;
+    clearSquare(gs, sq);
+    gs->board[sq] = piece;
+    if (piece == NONE)
+        return;
+
+    Bitboard b = BIT(sq);
+    gs->piece_bb[piece] |= b;
+    gs->color_bb[pieceColor(piece)] |= b;
+    gs->occupied_bb |= b;
+    gs->key ^= zobrist_piece[piece][sq];
+    if (piece == WP || piece == BP)
+        gs->pawn_key ^= zobrist_piece[piece][sq];
+    gs->mg_score += eval_mg[piece][sq];
+    gs->eg_score += eval_eg[piece][sq];
+    gs->phase += phase_weight[piece];
 }
 
-// Init the board with
-int init()
+// Empty a square, keeping the bitboards in sync with board
+static inline void clearSquare(struct GameState *gs, int sq)
+{
+    int old = gs->board[sq];
+    if (old != NONE)
+    {
+        Bitboard b = BIT(sq);
+        gs->piece_bb[old] &= ~b;
+        gs->color_bb[pieceColor(old)] &= ~b;
+        gs->occupied_bb &= ~b;
+        gs->key ^= zobrist_piece[old][sq];
+        if (old == WP || old == BP)
+            gs->pawn_key ^= zobrist_piece[old][sq];
+        gs->mg_score -= eval_mg[old][sq];
+        gs->eg_score -= eval_eg[old][sq];
+        gs->phase -= phase_weight[old];
+    }
+    gs->board[sq] = NONE;
+}
+
+// Square of the king of given color, -1 if it is missing
+int kingSquare(struct GameState *gs, int color)
 {
-    // initialise moveset variable
-    moveset = malloc(10 * sizeof(struct coordinate));
-    moveset_capacity = 10; // keep capacity in sync with allocation
-    pos = 0;
+    Bitboard k = gs->piece_bb[color == 1 ? WK : BK];
+    return k ? lsb(k) : -1;
+}
+/*---------------------- end bitboard helpers -----------------------*/
 
-    // initilisation with empty first
-    for (int row = 0; row < 8; row++)
+/*-------------------------- SLIDER ATTACKS --------------------------*/
+
+// Magic bitboards: the blockers on a slider's rays are hashed, either by a
+// magic multiply or by BMI2 pext, into an index of a precomputed attack table.
+struct magic
+{
+    Bitboard mask;     // relevant blocker squares (ray ends excluded)
+    Bitboard magic;    // multiplier, unused in pext mode
+    Bitboard *attacks; // this square's slice of rook_table / bishop_table
+    int shift;
+};
+
+struct magic rook_magics[64];
+struct magic bishop_magics[64];
+Bitboard rook_table[0x19000];  // 102400 entries for all rook squares
+Bitboard bishop_table[0x1480]; // 5248 entries for all bishop squares
+
+// set by initSliderAttacks when the CPU supports BMI2
+bool use_pext = false;
+
+// for two squares on a common rank, file or diagonal: the full line through
+// them, and the squares strictly between them (empty for any other pair)
+Bitboard line_bb[64][64];
+Bitboard between_bb[64][64];
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_PEXT 1
+#ifdef __BMI2__
+static inline unsigned pextIndex(Bitboard occ, Bitboard mask)
+#else
+__attribute__((target("bmi2"))) static unsigned pextIndex(Bitboard occ, Bitboard mask)
+#endif
+{
+    return (unsigned)_pext_u64(occ, mask);
+}
+#endif
+
+static inline unsigned magicIndex(const struct magic *m, Bitboard occ)
+{
+#ifdef HAVE_PEXT
+    if (use_pext)
+        return pextIndex(occ, m->mask);
+#endif
+    return (unsigned)(((occ & m->mask) * m->magic) >> m->shift);
+}
+
+static inline Bitboard rookAttacks(int sq, Bitboard occ)
+{
+    const struct magic *m = &rook_magics[sq];
+    return m->attacks[magicIndex(m, occ)];
+}
+
+static inline Bitboard bishopAttacks(int sq, Bitboard occ)
+{
+    const struct magic *m = &bishop_magics[sq];
+    return m->attacks[magicIndex(m, occ)];
+}
+
+static inline Bitboard queenAttacks(int sq, Bitboard occ)
+{
+    return rookAttacks(sq, occ) | bishopAttacks(sq, occ);
+}
+
+// Walk the rays square by square; only used to fill the tables
+static Bitboard slidingAttack(int sq, Bitboard occ, const int dirs[4][2])
+{
+    Bitboard attacks = 0;
+    for (int d = 0; d < 4; d++)
     {
-        for (int col = 0; col < 8; col++)
+        int row = sq / 8 + dirs[d][0], col = sq % 8 + dirs[d][1];
+        while (row >= 0 && row <= 7 && col >= 0 && col <= 7)
         {
-            board[row][col] = (struct piece){{row, col}, NONE, 0, 0, 0, 0};
+            attacks |= BIT(SQUARE(row, col));
+            if (occ & BIT(SQUARE(row, col)))
+                break;
+            row += dirs[d][0];
+            col += dirs[d][1];
         }
     }
+    return attacks;
+}
 
-    // Place pawns for both colors
-    for (int i = 0; i < 8; i++)
+// xorshift64* generator, fixed seeds keep magics and hash keys the same every run
+static Bitboard randomBitboard(Bitboard *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+static void initMagics(struct magic magics[64], Bitboard *table, const int dirs[4][2])
+{
+    Bitboard occupancy[4096], reference[4096];
+    int epoch[4096] = {0}, cnt = 0;
+    Bitboard *next = table;
+
+    // per-rank seeds that are known to find magics quickly
+    static const Bitboard seeds[8] = {728, 10316, 55013, 32803, 12281, 15100, 16645, 255};
+
+    for (int sq = 0; sq < 64; sq++)
+    {
+        struct magic *m = &magics[sq];
+        int row = sq / 8, col = sq % 8;
+
+        // blockers on the board edge never change the attack set
+        Bitboard edges = ((0xFFULL | 0xFF00000000000000ULL) & ~(0xFFULL << (8 * row))) |
+                         ((0x0101010101010101ULL | 0x8080808080808080ULL) & ~(0x0101010101010101ULL << col));
+        m->mask = slidingAttack(sq, 0, dirs) & ~edges;
+        m->shift = 64 - popcount(m->mask);
+        m->attacks = next;
+
+        // enumerate every subset of the mask (Carry-Rippler)
+        int size = 0;
+        Bitboard b = 0;
+        do
+        {
+            occupancy[size] = b;
+            reference[size] = slidingAttack(sq, b, dirs);
+            size++;
+            b = (b - m->mask) & m->mask;
+        } while (b);
+        next += size;
+
+#ifdef HAVE_PEXT
+        if (use_pext)
+        {
+            for (int i = 0; i < size; i++)
+                m->attacks[pextIndex(occupancy[i], m->mask)] = reference[i];
+            continue;
+        }
+#endif
+
+        // try sparse random multipliers until one maps every subset without a bad collision
+        Bitboard rng = seeds[row];
+        for (int i = 0; i < size;)
+        {
+            do
+                m->magic = randomBitboard(&rng) & randomBitboard(&rng) & randomBitboard(&rng);
+            while (popcount((m->magic * m->mask) >> 56) < 6);
+
+            cnt++;
+            for (i = 0; i < size; i++)
+            {
+                unsigned idx = magicIndex(m, occupancy[i]);
+                if (epoch[idx] < cnt)
+                {
+                    epoch[idx] = cnt;
+                    m->attacks[idx] = reference[i];
+                }
+                else if (m->attacks[idx] != reference[i])
+                    break;
+            }
+        }
+    }
+}
+
+// Build the rook and bishop attack tables, picking pext when available
+void initSliderAttacks()
+{
+    static const int rook_dirs[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+    static const int bishop_dirs[4][2] = {{-1, -1}, {-1, 1}, {1, -1}, {1, 1}};
+
+#ifdef HAVE_PEXT
+    __builtin_cpu_init();
+    use_pext = __builtin_cpu_supports("bmi2");
+#endif
+    initMagics(rook_magics, rook_table, rook_dirs);
+    initMagics(bishop_magics, bishop_table, bishop_dirs);
+
+    // lines through every pair of squares a rook or bishop could join
+    for (int s1 = 0; s1 < 64; s1++)
+    {
+        for (int s2 = 0; s2 < 64; s2++)
+        {
+            Bitboard ends = BIT(s1) | BIT(s2);
+            if (s1 != s2 && (rookAttacks(s1, 0) & BIT(s2)))
+            {
+                line_bb[s1][s2] = (rookAttacks(s1, 0) & rookAttacks(s2, 0)) | ends;
+                between_bb[s1][s2] = rookAttacks(s1, BIT(s2)) & rookAttacks(s2, BIT(s1));
+            }
+            else if (s1 != s2 && (bishopAttacks(s1, 0) & BIT(s2)))
+            {
+                line_bb[s1][s2] = (bishopAttacks(s1, 0) & bishopAttacks(s2, 0)) | ends;
+                between_bb[s1][s2] = bishopAttacks(s1, BIT(s2)) & bishopAttacks(s2, BIT(s1));
+            }
+        }
+    }
+}
+/*---------------------- end slider attacks -----------------------*/
+
+/*-------------------------- LEAPER ATTACKS --------------------------*/
+
+#define FILE_A 0x0101010101010101ULL
+#define FILE_B (FILE_A << 1)
+#define FILE_G (FILE_A << 6)
+#define FILE_H (FILE_A << 7)
+
+Bitboard knight_table[64];
+Bitboard king_table[64];
+Bitboard pawn_table[2][64]; // indexed by pawn color, then square
+
+// Fill the leaper tables from shifted square bits; called once at startup
+void initLeaperAttacks()
+{
+    for (int sq = 0; sq < 64; sq++)
+    {
+        Bitboard b = BIT(sq);
+        Bitboard one = ((b >> 1) & ~FILE_H) | ((b << 1) & ~FILE_A);
+        Bitboard two = ((b >> 2) & ~(FILE_G | FILE_H)) | ((b << 2) & ~(FILE_A | FILE_B));
+
+        knight_table[sq] = (one << 16) | (one >> 16) | (two << 8) | (two >> 8);
+        king_table[sq] = one | (one << 8) | (one >> 8) | (b << 8) | (b >> 8);
+        // white pawns move towards row 0
+        pawn_table[1][sq] = one >> 8;
+        pawn_table[0][sq] = one << 8;
+    }
+}
+
+static inline Bitboard knightAttacks(int sq)
+{
+    return knight_table[sq];
+}
+
+static inline Bitboard kingAttacks(int sq)
+{
+    return king_table[sq];
+}
+
+// squares a pawn of color on sq attacks
+static inline Bitboard pawnAttacks(int color, int sq)
+{
+    return pawn_table[color][sq];
+}
+/*---------------------- end leaper attacks -----------------------*/
+
+/*-------------------------- ATTACK QUERIES --------------------------*/
+
+// Is sq attacked by color, with occ as the blockers? Looks outward from sq with
+// each piece's attack pattern, cheapest first, and stops at the first hit.
+bool squareAttackedWith(struct GameState *gs, int sq, int color, Bitboard occ)
+{
+    Bitboard *bb = gs->piece_bb;
+    if (pawnAttacks(!color, sq) & bb[color ? WP : BP])
+        return true;
+    if (knightAttacks(sq) & bb[color ? WN : BN])
+        return true;
+    if (kingAttacks(sq) & bb[color ? WK : BK])
+        return true;
+    Bitboard queens = bb[color ? WQ : BQ];
+    if (bishopAttacks(sq, occ) & (bb[color ? WB : BB] | queens))
+        return true;
+    return (rookAttacks(sq, occ) & (bb[color ? WR : BR] | queens)) != 0;
+}
+
+bool is_square_attacked(struct GameState *gs, int sq, int color)
+{
+    return squareAttackedWith(gs, sq, color, gs->occupied_bb);
+}
+
+// Every piece of either color attacking sq, with occ as the blockers
+Bitboard attackersTo(struct GameState *gs, int sq, Bitboard occ)
+{
+    Bitboard *bb = gs->piece_bb;
+    return (pawnAttacks(0, sq) & bb[WP]) |
+           (pawnAttacks(1, sq) & bb[BP]) |
+           (knightAttacks(sq) & (bb[WN] | bb[BN])) |
+           (kingAttacks(sq) & (bb[WK] | bb[BK])) |
+           (rookAttacks(sq, occ) & (bb[WR] | bb[BR] | bb[WQ] | bb[BQ])) |
+           (bishopAttacks(sq, occ) & (bb[WB] | bb[BB] | bb[WQ] | bb[BQ]));
+}
+/*---------------------- end attack queries -----------------------*/
+
+// Init the board with
+int init(struct GameState *gs)
+{
+    static const enum PieceType back_rank[8] = {WR, WN, WB, WQ, WK, WB, WN, WR};
+
+    gs->side = 1;
+    gs->castling = WHITE_RIGHT | WHITE_LEFT | BLACK_RIGHT | BLACK_LEFT;
+    gs->ep_square = -1;
+    gs->halfmove = 0;
+    gs->fullmove = 1;
+    gs->ply = 0;
+    gs->history_len = 0;
+
+    // initilisation with empty first
+    memset(gs->board, NONE, sizeof(gs->board));
+    memset(gs->piece_bb, 0, sizeof(gs->piece_bb));
+    memset(gs->color_bb, 0, sizeof(gs->color_bb));
+    gs->occupied_bb = 0;
+    gs->key = 0;
+    gs->mg_score = gs->eg_score = gs->phase = 0;
+
+    // White pieces on the bottom rows, black mirrored at the top
+    for (int col = 0; col < 8; col++)
     {
-        struct piece wpawn = {{6, i}, WP, 0, 0, 0, 1};
-        board[6][i] = wpawn;
-        struct piece bpawn = {{1, i}, BP, 0, 0, 0, 0};
-        board[1][i] = bpawn;
-    }
-
-    // White pieces (bottom row)
-    struct piece wrook1 = {{7, 0}, WR, 0, 0, 0, 1};
-    struct piece wknight1 = {{7, 1}, WN, 0, 0, 0, 1};
-    struct piece wbishop1 = {{7, 2}, WB, 0, 0, 0, 1};
-    struct piece wqueen = {{7, 3}, WQ, 0, 0, 0, 1};
-    struct piece wking = {{7, 4}, WK, 0, 0, 0, 1};
-    struct piece wbishop2 = {{7, 5}, WB, 0, 0, 0, 1};
-    struct piece wknight2 = {{7, 6}, WN, 0, 0, 0, 1};
-    struct piece wrook2 = {{7, 7}, WR, 0, 0, 0, 1};
-
-    // Place white pieces
-    board[7][0] = wrook1;
-    board[7][1] = wknight1;
-    board[7][2] = wbishop1;
-    board[7][3] = wqueen;
-    board[7][4] = wking;
-    board[7][5] = wbishop2;
-    board[7][6] = wknight2;
-    board[7][7] = wrook2;
-
-    // Black pieces (top row)
-    struct piece brook1 = {{0, 0}, BR, 0, 0, 0, 0};
-    struct piece bknight1 = {{0, 1}, BN, 0, 0, 0, 0};
-    struct piece bbishop1 = {{0, 2}, BB, 0, 0, 0, 0};
-    struct piece bqueen = {{0, 3}, BQ, 0, 0, 0, 0};
-    struct piece bking = {{0, 4}, BK, 0, 0, 0, 0};
-    struct piece bbishop2 = {{0, 5}, BB, 0, 0, 0, 0};
-    struct piece bknight2 = {{0, 6}, BN, 0, 0, 0, 0};
-    struct piece brook2 = {{0, 7}, BR, 0, 0, 0, 0};
-
-    // Place black pieces
-    board[0][0] = brook1;
-    board[0][1] = bknight1;
-    board[0][2] = bbishop1;
-    board[0][3] = bqueen;
-    board[0][4] = bking;
-    board[0][5] = bbishop2;
-    board[0][6] = bknight2;
-    board[0][7] = brook2;
+        setSquare(gs, SQUARE(7, col), back_rank[col]);
+        setSquare(gs, SQUARE(6, col), WP);
+        setSquare(gs, SQUARE(1, col), BP);
+        setSquare(gs, SQUARE(0, col), back_rank[col] + BP);
+    }
+    gs->key = positionKey(gs);
+    gs->pawn_key = pawnKey(gs);
 
     return 0;
 }
 
 // Print the board to the console (for debugging)
-int print_board(struct piece board[8][8])
+int print_board(const uint8_t board[64])
 {
     // mapping for enums -> printable chars
     const char pieceChars[] = { 'P','R','N','B','Q','K', 'p','r','n','b','q','k', '_' };
@@ -186,22 +752,13 @@ int print_board(struct piece board[8][8])
     for (int i = 0; i < 8; i++)
     {
         for (int j = 0; j < 8; j++)
-        {
-            if (board[i][j].recog != NONE)
-            {
-                char c = pieceChars[board[i][j].recog];
-                printf("%c ", c);
-            }
-            else
-            {
-                printf("_ ");
-            }
-        }
+            printf("%c ", pieceChars[board[SQUARE(i, j)]]);
         printf("\n");
     }
     return 0;
 }
 
+#ifndef HEADLESS
 // Load piece images png file
 void loadImagesPNG(SDL_Renderer *renderer)
 {
@@ -245,12 +802,12 @@ void drawPiece(SDL_Renderer *renderer, SDL_Texture *texture, int row, int col)
     SDL_RenderCopy(renderer, texture, NULL, &dst);
 }
 
-// Map struct piece to enum PieceType index for texture lookup
-int getTextureIndex(struct piece p)
+// Map a board square's PieceType to its texture index
+int getTextureIndex(uint8_t piece)
 {
-    if (p.recog >= WP && p.recog <= BK)
+    if (piece <= BK)
     {
-        return p.recog;
+        return piece;
     }
     return -1;
 }
@@ -270,7 +827,7 @@ void cleanup(SDL_Renderer *renderer, SDL_Window *window)
 }
 
 // Draw chessboard squares and pieces
-void drawChessBoard(SDL_Renderer *renderer)
+void drawChessBoard(SDL_Renderer *renderer, struct GameState *gs)
 {
     for (int row = 0; row < 8; row++)
     {
@@ -289,7 +846,7 @@ void drawChessBoard(SDL_Renderer *renderer)
             SDL_RenderFillRect(renderer, &square);
 
             // Draw piece if present
-            int idx = getTextureIndex(board[row][col]);
+            int idx = getTextureIndex(gs->board[SQUARE(row, col)]);
             if (idx != -1 && pieceTextures[idx])
             {
                 drawPiece(renderer, pieceTextures[idx], row, col);
@@ -297,1045 +854,3024 @@ void drawChessBoard(SDL_Renderer *renderer)
         }
     }
 }
+#endif
 
 //---Game Loop---
+// arg is the struct game to play
 void *run(void *arg)
 {
+    struct game *g = arg;
+    struct GameState *gs = &g->pos;
+
     // keeping turn as a pointer for preview later, possible errors in this section
     // player move
-    char pmove = 'w';
+    char pmove = gs->side ? 'w' : 'b';
     char *turn = &pmove;
     struct coordinate move[2];
+    struct moveList legal;
 
     while (true)
     {
-        /* ---------- checkmate / stalemate ---------- */
-        struct coordinate wk[2] = {{-1,-1},{-1,-1}};
-        struct coordinate bk[2] = {{-1,-1},{-1,-1}};
-
-        // find kings
-        for (int i = 0; i < 8; i++) {
-            for (int j = 0; j < 8; j++) {
-                if (board[i][j].recog == WK) { wk[0].x = i; wk[0].y = j; wk[1].x = i; wk[1].y = j; }
-                else if (board[i][j].recog == BK) { bk[0].x = i; bk[0].y = j; bk[1].x = i; bk[1].y = j; }
-            }
-        }
-
         int cur_color = (*turn == 'w') ? 1 : 0;
-        struct coordinate king_pos = (cur_color == 1) ? wk[0] : bk[0];
-
-        if (king_pos.x >= 0 && king_pos.x < 8 && king_pos.y >= 0 && king_pos.y < 8) {
-            // generate opponent attack-map for current position (attacker = !cur_color)
-            struct coordinate am_query[2] = {{0,0}, { king_pos.x, king_pos.y }};
-            memset(attack_map, 0, sizeof(attack_map));
-            clearMoveset();
-            generateAM(am_query, !cur_color);
-            bool in_check = attack_map[king_pos.x][king_pos.y];
-            clearMoveset();
-
-            // search for any legal move for current side
-            int found_legal = 0;
-            for (int src_row = 0; src_row < 8 && !found_legal; src_row++) {
-                for (int src_col = 0; src_col < 8 && !found_legal; src_col++) {
-                    if (board[src_row][src_col].recog == NONE) continue;
-                    if (board[src_row][src_col].color != cur_color) continue;
-
-                    // generate moves for this piece
-                    struct coordinate test_move[2] = {{src_row, src_col}, {src_row, src_col}};
-                    clearMoveset();
-                    moveValidity(test_move, false);
-
-                    for (int move_index = 0; move_index < pos && !found_legal; move_index++) {
-                        struct coordinate dest = moveset[move_index];
-                        if (dest.x < 0 || dest.x > 7 || dest.y < 0 || dest.y > 7) continue;
-
-                        // backup source and dest
-                        struct piece src_backup = board[src_row][src_col];
-                        struct piece dest_backup = board[dest.x][dest.y];
-
-                        // en-passant handling: if pawn diagonal move to empty square, possible ep capture
-                        struct piece ep_victim = {0};
-                        int ep_row = -1, ep_col = -1;
-                        int ep_taken = 0;
-                        if ((src_backup.recog == WP || src_backup.recog == BP) &&
-                            (src_col != dest.y) && (src_row != dest.x) && dest_backup.recog == NONE) {
-                            int victim_row = (src_backup.recog == WP) ? dest.x + 1 : dest.x - 1;
-                            int victim_col = dest.y;
-                            if (victim_row >= 0 && victim_row < 8 && victim_col >= 0 && victim_col < 8) {
-                                struct piece maybe = board[victim_row][victim_col];
-                                if ((maybe.recog == WP || maybe.recog == BP) &&
-                                    maybe.color != src_backup.color &&
-                                    maybe.doubleMove == 1) {
-                                    ep_victim = maybe; ep_row = victim_row; ep_col = victim_col; ep_taken = 1;
-                                    board[victim_row][victim_col] = (struct piece){{victim_row, victim_col}, NONE,0,0,0,0};
-                                }
-                            }
-                        }
-
-                        // apply move
-                        board[dest.x][dest.y] = board[src_row][src_col];
-                        board[dest.x][dest.y].coord.x = dest.x;
-                        board[dest.x][dest.y].coord.y = dest.y;
-                        board[src_row][src_col] = (struct piece){{src_row, src_col}, NONE,0,0,0,0};
-
-                        // determine defender king position after move
-                        struct coordinate new_king = king_pos;
-                        if (src_backup.recog == WK || src_backup.recog == BK) new_king = dest;
-
-                        // regenerate opponent attack-map after this hypothetical move
-                        struct coordinate am_q2[2] = {{0,0}, { new_king.x, new_king.y }};
-                        memset(attack_map, 0, sizeof(attack_map));
-                        clearMoveset();
-                        generateAM(am_q2, !cur_color);
-
-                        bool king_safe = true;
-                        if (new_king.x >= 0 && new_king.x < 8 && new_king.y >= 0 && new_king.y < 8) {
-                            if (attack_map[new_king.x][new_king.y]) king_safe = false;
-                        } else king_safe = false;
-
-                        // rollback
-                        board[src_row][src_col] = src_backup;
-                        board[dest.x][dest.y] = dest_backup;
-                        if (ep_taken && ep_row >= 0) board[ep_row][ep_col] = ep_victim;
-                        clearMoveset();
-
-                        if (king_safe) { found_legal = 1; break; }
-                    } // end moves loop
-                }
-            } // end board scan
 
-            if (!found_legal) {
-                if (in_check) {
-                    if (cur_color == 1) printf("Checkmate by black\n"); else printf("Checkmate by white\n");
-                    break;
-                } else {
-                    // only declare stalemate if all adjacent king squares are either off-board, occupied by own piece, or attacked
-                    int kx = king_pos.x, ky = king_pos.y;
-                    int adj_has_safe = 0;
-                    for (int dx = -1; dx <= 1 && !adj_has_safe; dx++) {
-                        for (int dy = -1; dy <= 1 && !adj_has_safe; dy++) {
-                            if (dx == 0 && dy == 0) continue;
-                            int nx = kx + dx, ny = ky + dy;
-                            if (nx < 0 || nx > 7 || ny < 0 || ny > 7) continue;
-                            // square is candidate if empty or capturable (enemy piece)
-                            if (board[nx][ny].recog == NONE || board[nx][ny].color != cur_color) {
-                                // if not attacked it's a safe adjacent square
-                                if (!attack_map[nx][ny]) { adj_has_safe = 1; break; }
-                            }
-                        }
-                    }
-                    if (!adj_has_safe) {
-                        printf("Stalemate\n");
-                        break;
-                    }
-                }
+        /* ---------- checkmate / stalemate ---------- */
+        int legal_count = generateLegal(gs, &legal);
+        if (legal_count == 0)
+        {
+            if (kingInCheck(gs, cur_color))
+            {
+                if (cur_color == 1) printf("Checkmate by black\n"); else printf("Checkmate by white\n");
             }
-            clearMoveset();
+            else
+                printf("Stalemate\n");
+            break;
+        }
+        if (gs->halfmove >= 100)
+        {
+            printf("Draw by fifty-move rule\n");
+            break;
         }
         /* ---------- check mate/stalemate ---------- */
 
+        if (g->engine[cur_color])
+        {
+            struct searchContext ctx;
+            Move best = searchBestMove(&ctx, gs, &g->limits, &g->tt, g->threads);
+            char name[6];
+            moveToString(best, name);
+            printf("Engine plays %s (depth %d, score %d, %lld ms, %llu nodes, %llu in quiescence, %llu captures pruned by SEE, "
+                   "%.1f%% of cutoffs on the first move, %.1f moves generated per node, %.1f%% pawn table hits)\n",
+                   name, ctx.depth_done, ctx.best_score, (long long)elapsedMs(&ctx), (unsigned long long)ctx.nodes,
+                   (unsigned long long)ctx.qnodes, (unsigned long long)ctx.see_pruned,
+                   ctx.cutoffs ? 100.0 * ctx.first_move_cutoffs / ctx.cutoffs : 0.0,
+                   ctx.nodes ? (double)ctx.moves_generated / ctx.nodes : 0.0,
+                   ctx.pawns.probes ? 100.0 * ctx.pawns.hits / ctx.pawns.probes : 0.0);
+
+            commitMove(gs, best);
+            *turn = (*turn == 'b') ? 'w' : 'b';
+            continue;
+        }
+
+#ifdef HEADLESS
+        // no window shows the position
+        char fen[MAX_FEN];
+        toFEN(gs, fen);
+        print_board(gs->board);
+        printf("%s\n", fen);
+#endif
+
         // takes requested move coordinate by user
-        input(*turn, move);
+        char promo_char = input(*turn, move);
+        if (move[0].x == -4)
+        {
+            printf("Input closed\n");
+            break;
+        }
 
-        // Handle castling sentinel before accessing board indices
+        // Handle castling sentinel: it becomes the king moving two columns
+        char castle_side = 0;
+        int from = SQUARE(move[0].x, move[0].y);
+        int to = SQUARE(move[1].x, move[1].y);
         if (move[0].x < 0)
         {
-            char side = (move[0].x == -2) ? 'r' : 'l';
-            if (canCastle(cur_color, side))
-            {
-                doCastle(cur_color, side);
-                // switch turn
-                *turn = (*turn == 'b') ? 'w' : 'b';
-            }
-            else
-            {
-                printf("Illegal castle %c for %c\n", side, (*turn));
-            }
-            clearMoveset();
-            continue;
+            castle_side = (move[0].x == -2) ? 'r' : 'l';
+            from = kingSquare(gs, cur_color);
+            if (from < 0)
+                continue;
+            to = from + (castle_side == 'r' ? 2 : -2);
         }
-
         // checks the validity of input provided
-        if (board[move[0].x][move[0].y].recog == NONE)
+        else if (gs->board[from] == NONE)
         {
             printf("Empty square cannot be selected\n");
             continue;
         }
-        else if (board[move[0].x][move[0].y].color == 0 && *turn == 'w')
+        else if (pieceColor(gs->board[from]) == 0 && *turn == 'w')
         {
             printf("You cannot move opponent's piece\n");
             continue;
         }
-        else if (board[move[0].x][move[0].y].color == 1 && *turn == 'b')
+        else if (pieceColor(gs->board[from]) == 1 && *turn == 'b')
         {
             printf("You cannot move opponent's piece\n");
             continue;
         }
-        else if (board[move[1].x][move[1].y].recog != NONE && board[move[0].x][move[0].y].color == board[move[1].x][move[1].y].color)
+        else if (gs->board[to] != NONE && pieceColor(gs->board[from]) == pieceColor(gs->board[to]))
         {
             printf("You cannot capture your own piece\n");
             continue;
         }
 
         /*--------------------------VALIDITY OF MOVE CHECK-----------------*/
-        moveValidity(move, false);
-
-        for (int i = 0; i < pos; i++)
-        {
-            printf("X: %d,Y: %d \n", moveset[i].x, moveset[i].y);
-        }
-
-        struct piece p = board[move[0].x][move[0].y];
-        bool canMove = false;
-        for (int i = 0; i < pos; i++)
-        {
-            if (move[1].x == moveset[i].x && move[1].y == moveset[i].y)
-            {
-                canMove = true;
-
-                // if pawn and if its double move set it to moved and set move to moved
-                if (p.recog == WP || p.recog == BP)
-                {
-                    if (abs(move[1].x - move[0].x) == 2)
-                    {
-                        board[move[0].x][move[0].y].doubleMove = 1;
-                    }
-                    else
-                    {
-                        board[move[0].x][move[0].y].doubleMove = 0;
-                    }
-                }
-                board[move[0].x][move[0].y].moved = 1;
-            }
+        // pawns reaching the last row promote to a queen unless another piece is given
+        int promo_flag = PROMO_Q;
+        const char *promo_chars = "rnbq"; // in PROMO_* order
+        const char *pc = promo_char ? strchr(promo_chars, promo_char) : NULL;
+        if (pc)
+            promo_flag = PROMO_R + (int)(pc - promo_chars);
+
+        int chosen = -1;
+        for (int i = 0; i < legal_count; i++)
+        {
+            Move m = legal.moves[i];
+            if (MOVE_FROM(m) != from)
+                continue;
+            printf("X: %d,Y: %d \n", MOVE_TO(m) / 8, MOVE_TO(m) % 8);
+            if (MOVE_TO(m) == to && (MOVE_FLAG(m) < PROMO_R || MOVE_FLAG(m) == promo_flag))
+                chosen = i;
         }
         /*-----------------------------------------------------------------*/
 
-        if (canMove)
+        if (chosen < 0)
         {
-            struct piece src_backup = board[move[0].x][move[0].y];
+            if (castle_side)
+                printf("Illegal castle %c for %c\n", castle_side, (*turn));
+            else
+                printf("Illegal move\n");
+            continue;
+        }
 
-            struct piece captured = board[move[1].x][move[1].y];
+        // the game keeps no takeback history
+        commitMove(gs, legal.moves[chosen]);
 
-            struct piece ep_victim = {0};
-            int ep_row = -1, ep_col = -1;
-            int ep_taken = 0;
+        *turn = (*turn == 'b') ? 'w' : 'b';
+    }
+    return NULL;
+}
 
-            if (move[0].y != move[1].y && move[0].x != move[1].x)
-            {
-                if (p.recog == WP || p.recog == BP)
-                {
-                    if (board[move[1].x][move[1].y].recog == NONE)
-                    {
-                        int victimRow = (p.recog == WP) ? move[1].x + 1 : move[1].x - 1;
-                        int victimCol = move[1].y;
-                        if (victimRow >= 0 && victimRow < 8 && victimCol >= 0 && victimCol < 8)
-                        {
-                            struct piece maybe = board[victimRow][victimCol];
-                            if ((maybe.recog == WP || maybe.recog == BP) &&
-                                maybe.color != p.color &&
-                                maybe.doubleMove == 1)
-                            {
-                                ep_victim = maybe;
-                                ep_row = victimRow;
-                                ep_col = victimCol;
-                                ep_taken = 1;
-                                board[victimRow][victimCol] = (struct piece){{victimRow, victimCol}, NONE, 0, 0, 0, 0};
-                            }
-                        }
-                    }
-                }
-            }
+/*--------------------------VALIDITY OF MOVE CHECK-----------------*/
 
-            board[move[1].x][move[1].y] = board[move[0].x][move[0].y];
-            board[move[1].x][move[1].y].coord.x = move[1].x;
-            board[move[1].x][move[1].y].coord.y = move[1].y;
-            board[move[0].x][move[0].y] = (struct piece){{move[0].x, move[0].y}, NONE, 0, 0, 0, 0};
-
-            struct coordinate king_pos_after_move = {-1,-1};
-            // find mover's king (its color == src_backup.color)
-            for (int i = 0; i < 8; i++) {
-                for (int j = 0; j < 8; j++) {
-                    if ((board[i][j].recog == WK && src_backup.color == 1) ||
-                        (board[i][j].recog == BK && src_backup.color == 0)) {
-                        king_pos_after_move.x = i;
-                        king_pos_after_move.y = j;
-                        break;
-                    }
-                }
-                if (king_pos_after_move.x != -1) break;
-            }
+void moveValidity(struct GameState *gs, int from, Bitboard allowed, struct moveList *list)
+{
+    switch (gs->board[from])
+    {
+    case WP:
+    case BP:
+        movePawn(gs, from, allowed, list);
+        break;
+    case WR:
+    case BR:
+        moveRook(gs, from, allowed, list);
+        break;
+    case WN:
+    case BN:
+        moveKnight(gs, from, allowed, list);
+        break;
+    case WB:
+    case BB:
+        moveBishop(gs, from, allowed, list);
+        break;
+    case WQ:
+    case BQ:
+        moveQueen(gs, from, allowed, list);
+        break;
+    case WK:
+    case BK:
+        moveKing(gs, from, allowed, list);
+        break;
+    default:
+        printf("None");
+    }
+}
 
-            // generate attack map for opponent now (use the destination piece as reference; generateAM expects move[] but only uses board)
-            struct coordinate am_query2[2] = {{0,0}, { move[1].x, move[1].y }};
-            memset(attack_map, 0, sizeof(attack_map));
-            clearMoveset();
-            generateAM(am_query2, !cur_color);
+void moveKing(struct GameState *gs, int from, Bitboard allowed, struct moveList *list)
+{
+    int color = pieceColor(gs->board[from]);
 
-            // if mover's king is under attack, rollback and reject move
-            if (king_pos_after_move.x >= 0 && attack_map[king_pos_after_move.x][king_pos_after_move.y]) {
-                board[move[0].x][move[0].y] = src_backup;
-                board[move[0].x][move[0].y].coord.x = move[0].x;
-                board[move[0].x][move[0].y].coord.y = move[0].y;
+    putMoveBits(list, from, kingAttacks(from) & ~gs->color_bb[color] & allowed);
+}
 
-                board[move[1].x][move[1].y] = captured;
+void moveQueen(struct GameState *gs, int from, Bitboard allowed, struct moveList *list)
+{
+    int color = pieceColor(gs->board[from]);
 
-                if (ep_taken && ep_row >= 0)
-                    board[ep_row][ep_col] = ep_victim;
+    putMoveBits(list, from, queenAttacks(from, gs->occupied_bb) & ~gs->color_bb[color] & allowed);
+}
 
-                clearMoveset();
-                continue;
-            }
+void moveBishop(struct GameState *gs, int from, Bitboard allowed, struct moveList *list)
+{
+    int color = pieceColor(gs->board[from]);
 
-            *turn = (*turn == 'b') ? 'w' : 'b';
+    putMoveBits(list, from, bishopAttacks(from, gs->occupied_bb) & ~gs->color_bb[color] & allowed);
+}
 
-            clearMoveset();
-        }
+void moveKnight(struct GameState *gs, int from, Bitboard allowed, struct moveList *list)
+{
+    int color = pieceColor(gs->board[from]);
 
-        // clearing moveset
-        clearMoveset();
-    }
+    putMoveBits(list, from, knightAttacks(from) & ~gs->color_bb[color] & allowed);
 }
 
-/*--------------------------VALIDITY OF MOVE CHECK-----------------*/
-
-// generate attack map of enemy
-struct coordinate generateAM(struct coordinate move[], int attacker_color)
+void moveRook(struct GameState *gs, int from, Bitboard allowed, struct moveList *list)
 {
-    struct coordinate king_pos = {-1, -1};
-    struct coordinate current_coord;
-    memset(attack_map, 0, sizeof(attack_map));
-    clearMoveset();
+    int color = pieceColor(gs->board[from]);
 
+    putMoveBits(list, from, rookAttacks(from, gs->occupied_bb) & ~gs->color_bb[color] & allowed);
+}
+
+// add an en passant capture if it does not expose the mover's king. Two pieces
+// leave the same rank, so pins cannot be read off the usual masks.
+void putEnPassant(struct GameState *gs, struct moveList *list, int from, int to)
+{
+    int color = pieceColor(gs->board[from]);
+    int king_sq = kingSquare(gs, color);
+    Bitboard victim = BIT(to + (color ? 8 : -8));
+    Bitboard occ = (gs->occupied_bb ^ BIT(from) ^ victim) | BIT(to);
+    if (king_sq >= 0 && (attackersTo(gs, king_sq, occ) & gs->color_bb[!color] & ~victim))
+        return;
+    list->moves[list->count++] = MOVE(from, to, EN_PASSANT);
+}
+
+void movePawn(struct GameState *gs, int from, Bitboard allowed, struct moveList *list)
+{
+    int color = pieceColor(gs->board[from]);
+    // white pawns move towards row 0
+    int forward = color ? -8 : 8;
+    int to = from + forward;
+
+    // one-square forward, and two from the start row when both squares are empty
+    if (!(gs->occupied_bb & BIT(to)))
+    {
+        if (allowed & BIT(to))
+            putPawnMove(list, from, to);
+        int start_row = color ? 6 : 1;
+        if (from / 8 == start_row && !(gs->occupied_bb & BIT(to + forward)) && (allowed & BIT(to + forward)))
+            list->moves[list->count++] = MOVE(from, to + forward, DOUBLE_PUSH);
+    }
+
+    // captures (diagonals)
+    Bitboard attacks = pawnAttacks(color, from);
+    Bitboard captures = attacks & gs->color_bb[!color] & allowed;
+    while (captures)
+        putPawnMove(list, from, popLsb(&captures));
+
+    // en-passant captures; allowed holds the victim when it is the checker
+    if (gs->ep_square >= 0 && (attacks & BIT(gs->ep_square)) &&
+        (allowed & (BIT(gs->ep_square) | BIT(gs->ep_square + (color ? 8 : -8)))))
+        putEnPassant(gs, list, from, gs->ep_square);
+}
+/*-----------------------------------------------------------------*/
+
+/* Make the move after checking legality of the move
+   take move input in format e3b4, or e7e8n to promote to something other than a queen.
+   Returns the promotion letter, 0 if none was given. At the end of input
+   move[0] is set to {-4, -4} */
+char input(char turn, struct coordinate move[2])
+{
+    char coords[6] = {0};
+    printf("Enter move for %c: ", turn);
+    if (scanf("%5s", coords) != 1)
+    {
+        move[0] = (struct coordinate){-4, -4};
+        return 0;
+    }
+
+    convertToCoord(coords, move);
+    return coords[4];
+}
+ 
+void convertToCoord(char coord[], struct coordinate move[])
+{
+    // accept "cr" or "cl" as castle commands
+    if (coord[0] == 'c' && coord[1] == 'r' && coord[2] == '\0')
+    {
+        move[0] = (struct coordinate){-2, 0};
+        move[1] = (struct coordinate){-2, 0};
+        return;
+    }
+    if (coord[0] == 'c' && coord[1] == 'l' && coord[2] == '\0')
+    {
+        move[0] = (struct coordinate){-3, 0};
+        move[1] = (struct coordinate){-3, 0};
+        return;
+    }
+ 
+     // expecting input like "a8a6"
+     int col1 = coord[0] - 'a';       
+     int row1 = 8 - (coord[1] - '0'); 
+ 
+     int col2 = coord[2] - 'a';
+     int row2 = 8 - (coord[3] - '0');
+ 
+     if (0 <= col1 && col1 < 8 && 0 <= col2 && col2 < 8 &&
+         0 <= row1 && row1 < 8 && 0 <= row2 && row2 < 8)
+     {
+
+         printf("%d %d %d %d\n", row1, col1, row2, col2);
+
+         move[0] = (struct coordinate){row1, col1}; // (row, col)
+         move[1] = (struct coordinate){row2, col2};
+         return;
+     }
+
+     printf("Coordinate conversion error\n");
+ }
+
+/*-------------------------- CASTLING HELPERS --------------------------*/
+
+bool canCastle(struct GameState *gs, int color, char side)
+{
+    // the right is lost once the king or that rook moves or the rook is taken
+    int right = (side == 'r') ? WHITE_RIGHT : WHITE_LEFT;
+    if (!(gs->castling & (color ? right : right << 2))) return false;
+
+    int king_row = color ? 7 : 0;
+    int king_sq = SQUARE(king_row, 4);
+    if (gs->board[king_sq] != (color ? WK : BK)) return false;
+    int rook_col = (side == 'r') ? 7 : 0;
+    if (gs->board[SQUARE(king_row, rook_col)] != (color ? WR : BR)) return false;
+
+    // squares between king and rook must be empty
+    int dir = (side == 'r') ? 1 : -1;
+    if (gs->occupied_bb & between_bb[king_sq][SQUARE(king_row, rook_col)]) return false;
+
+    // squares king traverses must not be under attack and king must not be in check
+    for (int sq = king_sq; sq != king_sq + 3 * dir; sq += dir)
+        if (is_square_attacked(gs, sq, !color)) return false;
+
+    return true;
+}
+
+/*---------------------- end castling helpers -----------------------*/
+
+/*-------------------------- MAKE / UNMAKE --------------------------*/
+
+// castling rights lost when a piece moves from or to sq
+static inline int castleLoss(int sq)
+{
+    switch (sq)
+    {
+    case SQUARE(0, 0): return BLACK_LEFT;
+    case SQUARE(0, 4): return BLACK_LEFT | BLACK_RIGHT;
+    case SQUARE(0, 7): return BLACK_RIGHT;
+    case SQUARE(7, 0): return WHITE_LEFT;
+    case SQUARE(7, 4): return WHITE_LEFT | WHITE_RIGHT;
+    case SQUARE(7, 7): return WHITE_RIGHT;
+    }
+    return 0;
+}
+
+// Play a legal move for the side to move and push what is needed to take it
+// back onto the undo stack.
+void make_move(struct GameState *gs, Move m)
+{
+    struct undo *u = &gs->undo_stack[gs->ply++];
+    int from = MOVE_FROM(m), to = MOVE_TO(m), flag = MOVE_FLAG(m);
+    int piece = gs->board[from];
+
+    u->move = m;
+    u->captured = gs->board[to];
+    u->castling = gs->castling;
+    u->ep_square = gs->ep_square;
+    u->halfmove = gs->halfmove;
+    u->key = gs->key;
+
+    // the en-passant window closes after one move
+    if (gs->ep_square >= 0)
+        gs->key ^= zobrist_ep[gs->ep_square % 8];
+    gs->ep_square = -1;
+    gs->halfmove++;
+
+    if (flag == EN_PASSANT)
+    {
+        int victim = to + (gs->side ? 8 : -8);
+        u->captured = gs->board[victim];
+        clearSquare(gs, victim);
+    }
+    else if (flag == CASTLE)
+    {
+        // the rook jumps to the square the king passed over
+        int rook_from = (to > from) ? from + 3 : from - 4;
+        setSquare(gs, (from + to) / 2, gs->board[rook_from]);
+        clearSquare(gs, rook_from);
+    }
+    else if (flag == DOUBLE_PUSH)
+    {
+        gs->ep_square = (from + to) / 2;
+        gs->key ^= zobrist_ep[gs->ep_square % 8];
+    }
+
+    if (u->captured != NONE || piece == WP || piece == BP)
+        gs->halfmove = 0;
+    gs->castling &= ~(castleLoss(from) | castleLoss(to));
+    gs->key ^= castleKey(gs->castling ^ u->castling);
+
+    if (flag >= PROMO_R)
+        piece = promoPiece(flag, gs->side);
+    setSquare(gs, to, piece);
+    clearSquare(gs, from);
+
+    if (gs->side == 0)
+        gs->fullmove++;
+    gs->side ^= 1;
+    gs->key ^= zobrist_side;
+}
+
+// Take back the last move played with make_move
+void unmake_move(struct GameState *gs)
+{
+    struct undo *u = &gs->undo_stack[--gs->ply];
+    int from = MOVE_FROM(u->move), to = MOVE_TO(u->move), flag = MOVE_FLAG(u->move);
+
+    gs->side ^= 1;
+    if (gs->side == 0)
+        gs->fullmove--;
+
+    int piece = (flag >= PROMO_R) ? (gs->side ? WP : BP) : gs->board[to];
+    clearSquare(gs, to);
+    setSquare(gs, from, piece);
+
+    if (flag == CASTLE)
+    {
+        int rook_from = (to > from) ? from + 3 : from - 4;
+        setSquare(gs, rook_from, gs->board[(from + to) / 2]);
+        clearSquare(gs, (from + to) / 2);
+    }
+
+    if (u->captured != NONE)
+        setSquare(gs, (flag == EN_PASSANT) ? to + (gs->side ? 8 : -8) : to, u->captured);
+
+    gs->castling = u->castling;
+    gs->ep_square = u->ep_square;
+    gs->halfmove = u->halfmove;
+    gs->key = u->key;
+}
+
+// Pass the turn: used by null-move pruning, the undo entry holds move 0
+void make_null_move(struct GameState *gs)
+{
+    struct undo *u = &gs->undo_stack[gs->ply++];
+    u->move = 0;
+    u->captured = NONE;
+    u->castling = gs->castling;
+    u->ep_square = gs->ep_square;
+    u->halfmove = gs->halfmove;
+    u->key = gs->key;
+
+    if (gs->ep_square >= 0)
+        gs->key ^= zobrist_ep[gs->ep_square % 8];
+    gs->ep_square = -1;
+    gs->halfmove = 0; // no repetition can span a null move
+    gs->side ^= 1;
+    gs->key ^= zobrist_side;
+}
+
+void unmake_null_move(struct GameState *gs)
+{
+    struct undo *u = &gs->undo_stack[--gs->ply];
+    gs->side ^= 1;
+    gs->ep_square = u->ep_square;
+    gs->halfmove = u->halfmove;
+    gs->key = u->key;
+}
+
+// Play a move of the game itself, which is never taken back. gs must have no
+// moves to undo. The undo record is dropped so the stack never fills up; the
+// key of the position left behind moves to history for repetition checks.
+void commitMove(struct GameState *gs, Move m)
+{
+    make_move(gs, m);
+    if (gs->halfmove == 0)
+        gs->history_len = 0; // nothing before a capture or pawn move can repeat
+    else
+    {
+        if (gs->history_len == MAX_PLY)
+        {
+            memmove(gs->history, gs->history + 1, sizeof(gs->history[0]) * (MAX_PLY - 1));
+            gs->history_len--;
+        }
+        gs->history[gs->history_len++] = gs->undo_stack[0].key;
+    }
+    gs->ply = 0;
+}
+
+// True if the position occurred before, no further back than the last capture
+// or pawn move, with the same side to move
+bool isRepetition(const struct GameState *gs)
+{
+    for (int back = 4; back <= gs->halfmove; back += 2)
+    {
+        int at = gs->ply - back; // ply of that position, negative before the stack
+        uint64_t key;
+        if (at >= 0)
+            key = gs->undo_stack[at].key;
+        else if (-at <= gs->history_len)
+            key = gs->history[gs->history_len + at];
+        else
+            break;
+        if (key == gs->key)
+            return true;
+    }
+    return false;
+}
+
+// true if the king of color is attacked
+bool kingInCheck(struct GameState *gs, int color)
+{
+    int king_sq = kingSquare(gs, color);
+    return king_sq >= 0 && is_square_attacked(gs, king_sq, !color);
+}
+
+// Pieces of color that are the only blocker between their king and an enemy slider
+Bitboard pinnedPieces(struct GameState *gs, int color, int king_sq)
+{
+    Bitboard *bb = gs->piece_bb;
+    Bitboard queens = color ? bb[BQ] : bb[WQ];
+    Bitboard snipers = (rookAttacks(king_sq, 0) & ((color ? bb[BR] : bb[WR]) | queens)) |
+                       (bishopAttacks(king_sq, 0) & ((color ? bb[BB] : bb[WB]) | queens));
+    Bitboard pinned = 0;
+    while (snipers)
+    {
+        Bitboard blockers = between_bb[king_sq][popLsb(&snipers)] & gs->occupied_bb;
+        if (popcount(blockers) == 1)
+            pinned |= blockers & gs->color_bb[color];
+    }
+    return pinned;
+}
+
+enum GenType
+{
+    GEN_ALL,
+    GEN_CAPTURES, // captures, en passant and promotions
+    GEN_QUIETS    // everything else, castling included
+};
+
+// Fill list with the legal moves of kind gen for the side to move and return how many there are.
+// Checkers and pinned pieces are found once; each pseudo-move from the piece
+// generators is then kept only if it stays inside its piece's legal mask.
+// Castles are listed as the king moving two columns, promotions once per piece.
+int generateMoves(struct GameState *gs, struct moveList *list, int gen)
+{
+    int color = gs->side;
+    list->count = 0;
+
+    int king_sq = kingSquare(gs, color);
+    if (king_sq < 0)
+        return 0;
+
+    Bitboard enemies = gs->color_bb[!color];
+    Bitboard checkers = attackersTo(gs, king_sq, gs->occupied_bb) & enemies;
+    Bitboard pinned = pinnedPieces(gs, color, king_sq);
+
+    // destination filter of the requested kind; pawns count promotions
+    // and en passant as captures
+    Bitboard promo_rows = 0xFFULL | 0xFF00000000000000ULL;
+    Bitboard ep = (gs->ep_square >= 0) ? BIT(gs->ep_square) : 0;
+    Bitboard targets = ~0ULL, pawn_targets = ~0ULL;
+    if (gen == GEN_CAPTURES)
+    {
+        targets = enemies;
+        pawn_targets = enemies | promo_rows;
+    }
+    else if (gen == GEN_QUIETS)
+    {
+        targets = ~enemies;
+        pawn_targets = ~enemies & ~promo_rows & ~ep;
+    }
+
+    // the king must not stay on the ray it is moving away from
+    Bitboard occ_no_king = gs->occupied_bb ^ BIT(king_sq);
+    Bitboard king_safe = 0;
+    Bitboard king_targets = kingAttacks(king_sq) & ~gs->color_bb[color] & targets;
+    while (king_targets)
+    {
+        int to_sq = popLsb(&king_targets);
+        if (!squareAttackedWith(gs, to_sq, !color, occ_no_king))
+            king_safe |= BIT(to_sq);
+    }
+    moveKing(gs, king_sq, king_safe, list);
+
+    // in double check only the king can move
+    if (popcount(checkers) > 1)
+        return list->count;
+
+    // with one checker every non-king move must capture it or block
+    Bitboard check_mask = ~0ULL;
+    if (checkers)
+        check_mask = checkers | between_bb[king_sq][lsb(checkers)];
+
+    Bitboard own = gs->color_bb[color] ^ BIT(king_sq);
+    while (own)
+    {
+        int sq = popLsb(&own);
+        Bitboard allowed = check_mask;
+        if (pinned & BIT(sq))
+            allowed &= line_bb[king_sq][sq];
+
+        int type = gs->board[sq];
+        moveValidity(gs, sq, allowed & ((type == WP || type == BP) ? pawn_targets : targets), list);
+    }
+
+    for (int side = 0; side < 2 && !checkers && gen != GEN_CAPTURES; side++)
+    {
+        if (!canCastle(gs, color, side ? 'r' : 'l'))
+            continue;
+        list->moves[list->count++] = MOVE(king_sq, king_sq + (side ? 2 : -2), CASTLE);
+    }
+
+    return list->count;
+}
+
+int generateLegal(struct GameState *gs, struct moveList *list)
+{
+    return generateMoves(gs, list, GEN_ALL);
+}
+
+// Is m one of the legal moves of the position? Used for moves that come from
+// elsewhere (hash table, killers), so only the moving piece is generated.
+bool isLegalMove(struct GameState *gs, Move m)
+{
+    int from = MOVE_FROM(m), piece = gs->board[from];
+    if (piece == NONE || pieceColor(piece) != gs->side)
+        return false;
+
+    struct moveList list = {.count = 0};
+    if (MOVE_FLAG(m) == CASTLE)
+    {
+        int king_sq = SQUARE(gs->side ? 7 : 0, 4);
+        char side = (MOVE_TO(m) > king_sq) ? 'r' : 'l';
+        if (!canCastle(gs, gs->side, side))
+            return false;
+        list.moves[list.count++] = MOVE(king_sq, king_sq + (side == 'r' ? 2 : -2), CASTLE);
+    }
+    else
+        moveValidity(gs, from, ~0ULL, &list);
+
+    for (int i = 0; i < list.count; i++)
+    {
+        if (list.moves[i] != m)
+            continue;
+        make_move(gs, m);
+        bool legal = !kingInCheck(gs, !gs->side);
+        unmake_move(gs);
+        return legal;
+    }
+    return false;
+}
+
+// Write a move in coordinate notation, e.g. "e2e4" or "e7e8q"
+void moveToString(Move m, char out[6])
+{
+    out[0] = 'a' + MOVE_FROM(m) % 8;
+    out[1] = '8' - MOVE_FROM(m) / 8;
+    out[2] = 'a' + MOVE_TO(m) % 8;
+    out[3] = '8' - MOVE_TO(m) / 8;
+    out[4] = '\0';
+    if (MOVE_FLAG(m) >= PROMO_R)
+    {
+        out[4] = "rnbq"[MOVE_FLAG(m) - PROMO_R];
+        out[5] = '\0';
+    }
+}
+/*---------------------- end make / unmake -----------------------*/
+
+/*-------------------------- FEN --------------------------*/
+
+// Set up board from a FEN. The halfmove and fullmove counters are optional.
+// Returns the side to move, -1 on error.
+int loadFEN(struct GameState *gs, const char *fen)
+{
+    const char *pieceChars = "PRNBQKprnbqk";
+
+    for (int sq = 0; sq < 64; sq++)
+        clearSquare(gs, sq);
+    gs->mg_score = gs->eg_score = gs->phase = 0;
+    gs->castling = 0;
+    gs->ep_square = -1;
+    gs->halfmove = 0;
+    gs->fullmove = 1;
+    gs->ply = 0;
+    gs->history_len = 0;
+
+    int row = 0, col = 0;
+    for (; *fen && *fen != ' '; fen++)
+    {
+        if (*fen == '/')
+        {
+            if (col != 8)
+                return -1;
+            row++;
+            col = 0;
+        }
+        else if (*fen >= '1' && *fen <= '8')
+            col += *fen - '0';
+        else
+        {
+            const char *c = strchr(pieceChars, *fen);
+            if (!c || row > 7 || col > 7)
+                return -1;
+            setSquare(gs, SQUARE(row, col), (int)(c - pieceChars));
+            col++;
+        }
+    }
+    if (row != 7 || col != 8 || kingSquare(gs, 1) < 0 || kingSquare(gs, 0) < 0)
+        return -1;
+    // pawns never stand on the first or last row; the move generator relies on it
+    if ((gs->piece_bb[WP] | gs->piece_bb[BP]) & (0xFFULL | 0xFF00000000000000ULL))
+        return -1;
+
+    while (*fen == ' ') fen++;
+    if ((*fen != 'w' && *fen != 'b') || (fen[1] && fen[1] != ' '))
+        return -1;
+    gs->side = (*fen == 'b') ? 0 : 1;
+    fen++;
+    while (*fen == ' ') fen++;
+
+    // a right only counts while its king and rook are still on their squares
+    const char *rightChars = "KQkq"; // in castling bit order
+    for (; *fen && *fen != ' '; fen++)
+    {
+        const char *c = strchr(rightChars, *fen);
+        if (*fen == '-' || !c)
+            continue;
+        int white = (*fen == 'K' || *fen == 'Q');
+        int r = white ? 7 : 0;
+        int rook_col = (*fen == 'K' || *fen == 'k') ? 7 : 0;
+        if (gs->board[SQUARE(r, rook_col)] == (white ? WR : BR) && gs->board[SQUARE(r, 4)] == (white ? WK : BK))
+            gs->castling |= 1 << (c - rightChars);
+    }
+    while (*fen == ' ') fen++;
+
+    // only the side that did not just move can capture en passant: rank 6 with
+    // white to move, rank 3 with black to move, past an enemy pawn that just moved
+    if (fen[0] >= 'a' && fen[0] <= 'h' && fen[1] == (gs->side ? '6' : '3'))
+    {
+        int ep_col = fen[0] - 'a';
+        int ep_row = gs->side ? 2 : 5;
+        // the pawn sits one row past the en-passant square
+        int pawn_row = gs->side ? 3 : 4;
+        if (gs->board[SQUARE(pawn_row, ep_col)] == (gs->side ? BP : WP) && gs->board[SQUARE(ep_row, ep_col)] == NONE)
+            gs->ep_square = SQUARE(ep_row, ep_col);
+    }
+    while (*fen && *fen != ' ') fen++;
+
+    int halfmove, fullmove;
+    if (sscanf(fen, "%d %d", &halfmove, &fullmove) == 2 && halfmove >= 0 && fullmove >= 1)
+    {
+        gs->halfmove = halfmove;
+        gs->fullmove = fullmove;
+    }
+
+    gs->key = positionKey(gs);
+    gs->pawn_key = pawnKey(gs);
+    return gs->side;
+}
+
+// Write the position as a FEN that loadFEN() reads back to the same position
+void toFEN(const struct GameState *gs, char out[MAX_FEN])
+{
+    const char *pieceChars = "PRNBQKprnbqk";
+    char *p = out;
+
+    for (int row = 0; row < 8; row++)
+    {
+        int empty = 0;
+        for (int col = 0; col < 8; col++)
+        {
+            int piece = gs->board[SQUARE(row, col)];
+            if (piece == NONE)
+            {
+                empty++;
+                continue;
+            }
+            if (empty)
+                *p++ = '0' + empty;
+            empty = 0;
+            *p++ = pieceChars[piece];
+        }
+        if (empty)
+            *p++ = '0' + empty;
+        if (row < 7)
+            *p++ = '/';
+    }
+
+    *p++ = ' ';
+    *p++ = gs->side ? 'w' : 'b';
+    *p++ = ' ';
+    if (!gs->castling)
+        *p++ = '-';
+    for (int i = 0; i < 4; i++) // in castling bit order
+        if (gs->castling & (1 << i))
+            *p++ = "KQkq"[i];
+
+    *p++ = ' ';
+    if (gs->ep_square >= 0)
+    {
+        *p++ = 'a' + gs->ep_square % 8;
+        *p++ = '8' - gs->ep_square / 8;
+    }
+    else
+        *p++ = '-';
+    sprintf(p, " %d %d", gs->halfmove, gs->fullmove);
+}
+/*---------------------- end FEN -----------------------*/
+
+/*-------------------------- POSITION KEYS --------------------------*/
+
+void initZobrist()
+{
+    Bitboard rng = 0x9E3779B97F4A7C15ULL;
+    for (int p = 0; p < 12; p++)
+        for (int sq = 0; sq < 64; sq++)
+            zobrist_piece[p][sq] = randomBitboard(&rng);
+    for (int i = 0; i < 4; i++)
+        zobrist_castle[i] = randomBitboard(&rng);
     for (int i = 0; i < 8; i++)
+        zobrist_ep[i] = randomBitboard(&rng);
+    zobrist_side = randomBitboard(&rng);
+}
+
+// Hash the position from scratch
+uint64_t positionKey(struct GameState *gs)
+{
+    uint64_t key = gs->side ? zobrist_side : 0;
+    for (int p = WP; p <= BK; p++)
+    {
+        Bitboard b = gs->piece_bb[p];
+        while (b)
+            key ^= zobrist_piece[p][popLsb(&b)];
+    }
+
+    key ^= castleKey(gs->castling);
+
+    if (gs->ep_square >= 0)
+        key ^= zobrist_ep[gs->ep_square % 8];
+    return key;
+}
+
+// Hash the pawns from scratch
+uint64_t pawnKey(struct GameState *gs)
+{
+    uint64_t key = 0;
+    for (int p = WP; p <= BP; p += BP - WP)
+    {
+        Bitboard b = gs->piece_bb[p];
+        while (b)
+            key ^= zobrist_piece[p][popLsb(&b)];
+    }
+    return key;
+}
+/*---------------------- end position keys -----------------------*/
+
+/*-------------------------- PERFT --------------------------*/
+
+// Shared table of subtree counts. Entries are written without locks: check holds
+// key ^ data, so a torn entry from two threads writing at once fails verification.
+struct perftEntry
+{
+    _Atomic uint64_t check;
+    _Atomic uint64_t data; // node count << 8 | depth
+};
+
+struct perftEntry *perft_hash = NULL;
+uint64_t perft_hash_mask = 0;
+
+// Allocate the perft hash with the largest power of two entry count that fits in mb
+void initPerftHash(int mb)
+{
+    uint64_t entries = 1;
+    while (entries * 2 * sizeof(struct perftEntry) <= (uint64_t)mb * 1024 * 1024)
+        entries *= 2;
+    perft_hash = calloc(entries, sizeof(struct perftEntry));
+    perft_hash_mask = perft_hash ? entries - 1 : 0;
+}
+
+// Count the leaf nodes of the legal move tree of the given depth
+uint64_t perft(struct GameState *gs, int depth)
+{
+    if (depth == 0)
+        return 1;
+
+    struct moveList list;
+    int n = generateLegal(gs, &list);
+    if (depth == 1)
+        return n;
+
+    uint64_t key = 0;
+    struct perftEntry *entry = NULL;
+    if (perft_hash)
+    {
+        key = gs->key;
+        entry = &perft_hash[key & perft_hash_mask];
+        uint64_t data = atomic_load_explicit(&entry->data, memory_order_relaxed);
+        uint64_t check = atomic_load_explicit(&entry->check, memory_order_relaxed);
+        if ((check ^ data) == key && (int)(data & 0xFF) == depth)
+            return data >> 8;
+    }
+
+    uint64_t nodes = 0;
+    for (int i = 0; i < n; i++)
+    {
+        make_move(gs, list.moves[i]);
+        nodes += perft(gs, depth - 1);
+        unmake_move(gs);
+    }
+
+    if (entry)
+    {
+        uint64_t data = (nodes << 8) | (uint64_t)depth;
+        atomic_store_explicit(&entry->check, key ^ data, memory_order_relaxed);
+        atomic_store_explicit(&entry->data, data, memory_order_relaxed);
+    }
+    return nodes;
+}
+
+// One subtree for a worker: the root move index and the line leading to it
+struct perftTask
+{
+    int root;
+    int nmoves;
+    Move moves[2];
+};
+
+struct perftJob
+{
+    const struct GameState *root;
+    int depth;
+    struct perftTask *tasks;
+    int ntasks;
+    atomic_int next;              // next task to hand out
+    _Atomic uint64_t *root_counts; // nodes below each root move
+};
+
+// Worker thread: take tasks until none are left, counting them on a private board
+void *perftWorker(void *arg)
+{
+    struct perftJob *job = arg;
+    struct GameState gs = *job->root;
+
+    int i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->ntasks)
+    {
+        struct perftTask *task = &job->tasks[i];
+        for (int m = 0; m < task->nmoves; m++)
+            make_move(&gs, task->moves[m]);
+        uint64_t count = perft(&gs, job->depth - task->nmoves);
+        for (int m = 0; m < task->nmoves; m++)
+            unmake_move(&gs);
+        atomic_fetch_add(&job->root_counts[task->root], count);
+    }
+
+    return NULL;
+}
+
+// perft/divide command line mode; divide prints the node count below every root move.
+// The tree is split two plies deep into tasks shared out between the threads.
+int runPerft(int depth, const char *fen, bool divide, int threads, int hash_mb)
+{
+    struct GameState gs;
+    init(&gs);
+    if (loadFEN(&gs, fen) < 0)
+    {
+        printf("Invalid FEN: %s\n", fen);
+        return 1;
+    }
+    if (threads < 1)
+        threads = 1;
+    if (hash_mb > 0)
+        initPerftHash(hash_mb);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct moveList list = {0};
+    int n = (depth > 0) ? generateLegal(&gs, &list) : 0;
+
+    struct perftJob job = {0};
+    job.root = &gs;
+    job.depth = depth;
+    job.tasks = malloc(sizeof(struct perftTask) * MAX_MOVES * (depth >= 3 ? MAX_MOVES : 1));
+    job.root_counts = calloc(MAX_MOVES, sizeof(*job.root_counts));
+    atomic_init(&job.next, 0);
+
+    for (int i = 0; i < n; i++)
+    {
+        if (depth < 3)
+        {
+            job.tasks[job.ntasks++] = (struct perftTask){i, 1, {list.moves[i]}};
+            continue;
+        }
+
+        struct moveList replies;
+        make_move(&gs, list.moves[i]);
+        int r = generateLegal(&gs, &replies);
+        unmake_move(&gs);
+        for (int j = 0; j < r; j++)
+            job.tasks[job.ntasks++] = (struct perftTask){i, 2, {list.moves[i], replies.moves[j]}};
+    }
+
+    if (threads > job.ntasks)
+        threads = job.ntasks > 0 ? job.ntasks : 1;
+    pthread_t *workers = malloc(sizeof(pthread_t) * threads);
+    for (int t = 1; t < threads; t++)
+        pthread_create(&workers[t], NULL, perftWorker, &job);
+    perftWorker(&job);
+    for (int t = 1; t < threads; t++)
+        pthread_join(workers[t], NULL);
+
+    uint64_t nodes = (depth == 0) ? 1 : 0;
+    for (int i = 0; i < n; i++)
     {
-        for (int j = 0; j < 8; j++)
+        uint64_t count = atomic_load(&job.root_counts[i]);
+        if (divide)
         {
-            struct piece current = board[i][j];
-            if (current.recog == NONE)
-                continue;
+            char name[6];
+            moveToString(list.moves[i], name);
+            printf("%s: %llu\n", name, (unsigned long long)count);
+        }
+        nodes += count;
+    }
+    if (divide)
+        printf("\n");
 
-            if (current.color != attacker_color)
-                continue;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
 
-            if (current.recog == WK || current.recog == BK)
+    printf("Nodes: %llu\n", (unsigned long long)nodes);
+    printf("Time: %.3f s\n", seconds);
+    printf("NPS: %.0f\n", seconds > 0 ? nodes / seconds : 0.0);
+    printf("Threads: %d\n", threads);
+
+    free(workers);
+    free(job.tasks);
+    free(job.root_counts);
+    free(perft_hash);
+    perft_hash = NULL;
+    return 0;
+}
+/*---------------------- end perft -----------------------*/
+
+/*-------------------------- EVALUATION --------------------------*/
+
+// Plain material values, used for move ordering; P R N B Q K
+static const int piece_value[6] = {100, 500, 320, 330, 900, 0};
+
+// Midgame and endgame material, P R N B Q K
+static const int mg_value[6] = {82, 477, 337, 365, 1025, 0};
+static const int eg_value[6] = {94, 512, 281, 297, 936, 0};
+
+// Midgame and endgame piece-square bonuses for white, row 0 (rank 8) first;
+// black reads them mirrored
+static const int pst[6][2][64] = {
+    // pawn
+    {{  0,   0,   0,   0,   0,   0,   0,   0,
+       98, 134,  61,  95,  68, 126,  34, -11,
+       -6,   7,  26,  31,  65,  56,  25, -20,
+      -14,  13,   6,  21,  23,  12,  17, -23,
+      -27,  -2,  -5,  12,  17,   6,  10, -25,
+      -26,  -4,  -4, -10,   3,   3,  33, -12,
+      -35,  -1, -20, -23, -15,  24,  38, -22,
+        0,   0,   0,   0,   0,   0,   0,   0},
+     {  0,   0,   0,   0,   0,   0,   0,   0,
+      178, 173, 158, 134, 147, 132, 165, 187,
+       94, 100,  85,  67,  56,  53,  82,  84,
+       32,  24,  13,   5,  -2,   4,  17,  17,
+       13,   9,  -3,  -7,  -7,  -8,   3,  -1,
+        4,   7,  -6,   1,   0,  -5,  -1,  -8,
+       13,   8,   8,  10,  13,   0,   2,  -7,
+        0,   0,   0,   0,   0,   0,   0,   0}},
+    // rook
+    {{ 32,  42,  32,  51,  63,   9,  31,  43,
+       27,  32,  58,  62,  80,  67,  26,  44,
+       -5,  19,  26,  36,  17,  45,  61,  16,
+      -24, -11,   7,  26,  24,  35,  -8, -20,
+      -36, -26, -12,  -1,   9,  -7,   6, -23,
+      -45, -25, -16, -17,   3,   0,  -5, -33,
+      -44, -16, -20,  -9,  -1,  11,  -6, -71,
+      -19, -13,   1,  17,  16,   7, -37, -26},
+     { 13,  10,  18,  15,  12,  12,   8,   5,
+       11,  13,  13,  11,  -3,   3,   8,   3,
+        7,   7,   7,   5,   4,  -3,  -5,  -3,
+        4,   3,  13,   1,   2,   1,  -1,   2,
+        3,   5,   8,   4,  -5,  -6,  -8, -11,
+       -4,   0,  -5,  -1,  -7, -12,  -8, -16,
+       -6,  -6,   0,   2,  -9,  -9, -11,  -3,
+       -9,   2,   3,  -1,  -5, -13,   4, -20}},
+    // knight
+    {{-167, -89, -34, -49,  61, -97, -15, -107,
+       -73, -41,  72,  36,  23,  62,   7,  -17,
+       -47,  60,  37,  65,  84, 129,  73,   44,
+        -9,  17,  19,  53,  37,  69,  18,   22,
+       -13,   4,  16,  13,  28,  19,  21,   -8,
+       -23,  -9,  12,  10,  19,  17,  25,  -16,
+       -29, -53, -12,  -3,  -1,  18, -14,  -19,
+      -105, -21, -58, -33, -17, -28, -19,  -23},
+     { -58, -38, -13, -28, -31, -27, -63,  -99,
+       -25,  -8, -25,  -2,  -9, -25, -24,  -52,
+       -24, -20,  10,   9,  -1,  -9, -19,  -41,
+       -17,   3,  22,  22,  22,  11,   8,  -18,
+       -18,  -6,  16,  25,  16,  17,   4,  -18,
+       -23,  -3,  -1,  15,  10,  -3, -20,  -22,
+       -42, -20, -10,  -5,  -2, -20, -23,  -44,
+       -29, -51, -23, -15, -22, -18, -50,  -64}},
+    // bishop
+    {{-29,   4, -82, -37, -25, -42,   7,  -8,
+      -26,  16, -18, -13,  30,  59,  18, -47,
+      -16,  37,  43,  40,  35,  50,  37,  -2,
+       -4,   5,  19,  50,  37,  37,   7,  -2,
+       -6,  13,  13,  26,  34,  12,  10,   4,
+        0,  15,  15,  15,  14,  27,  18,  10,
+        4,  15,  16,   0,   7,  21,  33,   1,
+      -33,  -3, -14, -21, -13, -12, -39, -21},
+     {-14, -21, -11,  -8,  -7,  -9, -17, -24,
+       -8,  -4,   7, -12,  -3, -13,  -4, -14,
+        2,  -8,   0,  -1,  -2,   6,   0,   4,
+       -3,   9,  12,   9,  14,  10,   3,   2,
+       -6,   3,  13,  19,   7,  10,  -3,  -9,
+      -12,  -3,   8,  10,  13,   3,  -7, -15,
+      -14, -18,  -7,  -1,   4,  -9, -15, -27,
+      -23,  -9, -23,  -5,  -9, -16,  -5, -17}},
+    // queen
+    {{-28,   0,  29,  12,  59,  44,  43,  45,
+      -24, -39,  -5,   1, -16,  57,  28,  54,
+      -13, -17,   7,   8,  29,  56,  47,  57,
+      -27, -27, -16, -16,  -1,  17,  -2,   1,
+       -9, -26,  -9, -10,  -2,  -4,   3,  -3,
+      -14,   2, -11,  -2,  -5,   2,  14,   5,
+      -35,  -8,  11,   2,   8,  15,  -3,   1,
+       -1, -18,  -9,  10, -15, -25, -31, -50},
+     { -9,  22,  22,  27,  27,  19,  10,  20,
+      -17,  20,  32,  41,  58,  25,  30,   0,
+      -20,   6,   9,  49,  47,  35,  19,   9,
+        3,  22,  24,  45,  57,  40,  57,  36,
+      -18,  28,  19,  47,  31,  34,  39,  23,
+      -16, -27,  15,   6,   9,  17,  10,   5,
+      -22, -23, -30, -16, -16, -23, -36, -32,
+      -33, -28, -22, -43,  -5, -32, -20, -41}},
+    // king
+    {{-65,  23,  16, -15, -56, -34,   2,  13,
+       29,  -1, -20,  -7,  -8,  -4, -38, -29,
+       -9,  24,   2, -16, -20,   6,  22, -22,
+      -17, -20, -12, -27, -30, -25, -14, -36,
+      -49,  -1, -27, -39, -46, -44, -33, -51,
+      -14, -14, -22, -46, -44, -30, -15, -27,
+        1,   7,  -8, -64, -43, -16,   9,   8,
+      -15,  36,  12, -54,   8, -28,  24,  14},
+     {-74, -35, -18, -18, -11,  15,   4, -17,
+      -12,  17,  14,  17,  17,  38,  23,  11,
+       10,  17,  23,  15,  20,  45,  44,  13,
+       -8,  22,  24,  27,  26,  33,  26,   3,
+      -18,  -4,  21,  24,  27,  23,   9, -11,
+      -19,  -3,  11,  21,  23,  16,   7,  -9,
+      -27, -11,   4,  13,  14,   4,  -5, -17,
+      -53, -34, -21, -11, -28, -14, -24, -43}}};
+
+// Pawn structure weights, midgame and endgame
+#define DOUBLED_MG -10 // per pawn behind another one on its column
+#define DOUBLED_EG -25
+#define ISOLATED_MG -10 // no own pawns on the neighbouring columns
+#define ISOLATED_EG -15
+#define BACKWARD_MG -8 // behind its neighbours and cannot advance safely
+#define BACKWARD_EG -10
+#define SHIELD_NEAR 15 // own pawn one row in front of the king, or the next column
+#define SHIELD_FAR 8   // two rows in front
+
+// Passed pawn bonus by rows advanced from the pawn's own back rank
+static const int passed_mg[8] = {0, 5, 10, 15, 25, 45, 70, 0};
+static const int passed_eg[8] = {0, 10, 15, 25, 45, 75, 120, 0};
+
+// By color, then square: the squares in front of a pawn on its column and the
+// neighbouring ones (no enemy pawns there makes it passed), and the squares on
+// the neighbouring columns level with or behind it (where its defenders stand)
+Bitboard passed_mask[2][64];
+Bitboard support_mask[2][64];
+
+// Fold material into the piece-square tables for both colors, and build the
+// pawn structure masks
+void initEval()
+{
+    for (int sq = 0; sq < 64; sq++)
+    {
+        int row = sq / 8, col = sq % 8;
+        for (int r = 0; r < 8; r++)
+            for (int c = col - 1; c <= col + 1; c++)
             {
-                king_pos.x = i;
-                king_pos.y = j;
+                if (c < 0 || c > 7)
+                    continue;
+                Bitboard b = BIT(SQUARE(r, c));
+                // white pawns move towards row 0
+                if (r < row)
+                    passed_mask[1][sq] |= b;
+                if (r > row)
+                    passed_mask[0][sq] |= b;
+                if (c != col && r >= row)
+                    support_mask[1][sq] |= b;
+                if (c != col && r <= row)
+                    support_mask[0][sq] |= b;
             }
+    }
 
-            struct coordinate nmove[2];
-            nmove[0].x = i; nmove[0].y = j;
-            nmove[1].x = i; nmove[1].y = j; 
-            moveValidity(nmove, true);
+    for (int p = WP; p <= BK; p++)
+    {
+        int type = p % 6;
+        int sign = pieceColor(p) ? 1 : -1;
+        for (int sq = 0; sq < 64; sq++)
+        {
+            int rel = pieceColor(p) ? sq : sq ^ 56;
+            eval_mg[p][sq] = sign * (mg_value[type] + pst[type][0][rel]);
+            eval_eg[p][sq] = sign * (eg_value[type] + pst[type][1][rel]);
         }
     }
+}
+
+// Doubled, isolated, backward and passed pawn terms of one color
+void pawnStructure(struct GameState *gs, int color, int16_t *mg, int16_t *eg)
+{
+    Bitboard own = gs->piece_bb[color ? WP : BP];
+    Bitboard enemy = gs->piece_bb[color ? BP : WP];
+    int score_mg = 0, score_eg = 0;
 
-    for (int k = 0; k < pos; k++)
+    for (int col = 0; col < 8; col++)
     {
-        int x = moveset[k].x;
-        int y = moveset[k].y;
-        if (x >= 0 && x < 8 && y >= 0 && y < 8)
-            attack_map[x][y] = true;
+        int n = popcount(own & (FILE_A << col));
+        if (n > 1)
+        {
+            score_mg += (n - 1) * DOUBLED_MG;
+            score_eg += (n - 1) * DOUBLED_EG;
+        }
     }
 
-    clearMoveset();
-    return king_pos;
+    Bitboard b = own;
+    while (b)
+    {
+        int sq = popLsb(&b);
+        int col = sq % 8;
+        Bitboard neighbours = (col > 0 ? FILE_A << (col - 1) : 0) | (col < 7 ? FILE_A << (col + 1) : 0);
+
+        if (!(own & neighbours))
+        {
+            score_mg += ISOLATED_MG;
+            score_eg += ISOLATED_EG;
+        }
+        else if (!(own & support_mask[color][sq]))
+        {
+            // nothing can defend it, and an enemy pawn guards the square in front
+            int stop = color ? sq - 8 : sq + 8;
+            if (stop >= 0 && stop < 64 && (pawn_table[color][stop] & enemy))
+            {
+                score_mg += BACKWARD_MG;
+                score_eg += BACKWARD_EG;
+            }
+        }
+
+        if (!(enemy & passed_mask[color][sq]) && !(own & passed_mask[color][sq] & (FILE_A << col)))
+        {
+            int advanced = color ? 7 - sq / 8 : sq / 8;
+            score_mg += passed_mg[advanced];
+            score_eg += passed_eg[advanced];
+        }
+    }
+    *mg = score_mg;
+    *eg = score_eg;
 }
 
-void moveValidity(struct coordinate move[], bool AMCall)
+// Own pawns on the king's column and its neighbours, one or two rows in front
+int kingShield(struct GameState *gs, int color, int king_sq)
 {
+    Bitboard pawns = gs->piece_bb[color ? WP : BP] & passed_mask[color][king_sq];
+    int row = king_sq / 8;
+    int near = color ? row - 1 : row + 1;
+    int far = color ? row - 2 : row + 2;
+    int score = 0;
+    if (near >= 0 && near < 8)
+        score += SHIELD_NEAR * popcount(pawns & (0xFFULL << (8 * near)));
+    if (far >= 0 && far < 8)
+        score += SHIELD_FAR * popcount(pawns & (0xFFULL << (8 * far)));
+    return score;
+}
 
-    if (board[move[0].x][move[0].y].recog == WP || board[move[0].x][move[0].y].recog == BP)
+// Add the pawn structure and king shield terms, white minus black, looking
+// them up in pt first when one is given
+void pawnTerms(struct GameState *gs, struct pawnTable *pt, int *mg, int *eg)
+{
+    struct pawnEntry local;
+    struct pawnEntry *e = &local;
+    bool hit = false;
+    if (pt)
+    {
+        e = &pt->entries[gs->pawn_key & (PAWN_TABLE_SIZE - 1)];
+        hit = e->key == gs->pawn_key;
+        pt->probes++;
+        pt->hits += hit;
+    }
+    if (!hit)
     {
-        movePawn(move, AMCall);
+        e->key = gs->pawn_key;
+        for (int color = 0; color < 2; color++)
+        {
+            pawnStructure(gs, color, &e->mg[color], &e->eg[color]);
+            e->king_sq[color] = -1;
+        }
     }
-    else if (board[move[0].x][move[0].y].recog == WR || board[move[0].x][move[0].y].recog == BR)
+
+    // the pawns are unchanged, but the king may have moved
+    for (int color = 0; color < 2; color++)
     {
-        moveRook(move);
+        int king_sq = kingSquare(gs, color);
+        if (king_sq != e->king_sq[color])
+        {
+            e->king_sq[color] = king_sq;
+            e->shield[color] = king_sq < 0 ? 0 : kingShield(gs, color, king_sq);
+        }
     }
-    else if (board[move[0].x][move[0].y].recog == WN || board[move[0].x][move[0].y].recog == BN)
+
+    *mg += e->mg[1] - e->mg[0] + e->shield[1] - e->shield[0];
+    *eg += e->eg[1] - e->eg[0];
+}
+
+// Tapered blend of the incrementally kept midgame and endgame sums and the
+// pawn terms, from the point of view of the side to move. pt may be NULL.
+int evaluate(struct GameState *gs, struct pawnTable *pt)
+{
+    int mg = gs->mg_score, eg = gs->eg_score;
+    pawnTerms(gs, pt, &mg, &eg);
+
+    int phase = gs->phase < 24 ? gs->phase : 24; // promotions can push it past 24
+    int score = (mg * phase + eg * (24 - phase)) / 24;
+    return gs->side ? score : -score;
+}
+/*---------------------- end evaluation -----------------------*/
+
+/*-------------------------- SEARCH --------------------------*/
+
+// Allocate the largest power of two number of slots that fits in mb
+void initTransTable(struct transTable *tt, int mb)
+{
+    uint64_t entries = 1;
+    while (entries * 2 * sizeof(struct ttSlot) <= (uint64_t)mb * 1024 * 1024)
+        entries *= 2;
+    tt->slots = calloc(entries, sizeof(struct ttSlot));
+    tt->mask = tt->slots ? entries - 1 : 0;
+}
+
+void freeTransTable(struct transTable *tt)
+{
+    free(tt->slots);
+    tt->slots = NULL;
+    tt->mask = 0;
+}
+
+void clearTransTable(struct transTable *tt)
+{
+    if (tt->slots)
+        memset(tt->slots, 0, (tt->mask + 1) * sizeof(struct ttSlot));
+}
+
+// Mate scores are stored relative to the node, not the root, so they stay
+// right when the position turns up again at another ply
+static inline int scoreToTT(int score, int ply)
+{
+    return score >= MATE_SCORE - MAX_PLY ? score + ply : score <= -MATE_SCORE + MAX_PLY ? score - ply : score;
+}
+
+static inline int scoreFromTT(int score, int ply)
+{
+    return score >= MATE_SCORE - MAX_PLY ? score - ply : score <= -MATE_SCORE + MAX_PLY ? score + ply : score;
+}
+
+// Look up key; false if its slot holds another position or a torn write
+bool ttProbe(struct transTable *tt, uint64_t key, struct ttEntry *out)
+{
+    struct ttSlot *slot = &tt->slots[key & tt->mask];
+    uint64_t data = atomic_load_explicit(&slot->data, memory_order_relaxed);
+    uint64_t check = atomic_load_explicit(&slot->check, memory_order_relaxed);
+    if ((check ^ data) != key)
+        return false;
+    *out = (struct ttEntry){(Move)data, (int16_t)(data >> 16), (uint8_t)(data >> 32), (uint8_t)(data >> 40)};
+    return true;
+}
+
+// Keep the deeper result for the same position; a different position always replaces
+void ttStore(struct transTable *tt, uint64_t key, int depth, int bound, int score, Move move, int ply)
+{
+    struct ttSlot *slot = &tt->slots[key & tt->mask];
+    struct ttEntry old;
+    if (ttProbe(tt, key, &old))
     {
-        moveKnight(move);
+        if (depth < old.depth && bound != BOUND_EXACT)
+            return;
+        if (!move)
+            move = old.move;
     }
-    else if (board[move[0].x][move[0].y].recog == WB || board[move[0].x][move[0].y].recog == BB)
+    uint64_t data = move | (uint64_t)(uint16_t)scoreToTT(score, ply) << 16 |
+                    (uint64_t)depth << 32 | (uint64_t)bound << 40;
+    atomic_store_explicit(&slot->check, key ^ data, memory_order_relaxed);
+    atomic_store_explicit(&slot->data, data, memory_order_relaxed);
+}
+
+static int64_t elapsedMs(const struct searchContext *ctx)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - ctx->start.tv_sec) * 1000 + (now.tv_nsec - ctx->start.tv_nsec) / 1000000;
+}
+
+/*-------------------------- MOVE ORDERING --------------------------*/
+
+#define HASH_MOVE_SCORE 2000000000
+#define CAPTURE_SCORE 1000000000 // plus MVV-LVA
+#define KILLER_SCORE 900000000   // first killer, the second one scores one less
+
+static inline bool isCapture(struct GameState *gs, Move m)
+{
+    return gs->board[MOVE_TO(m)] != NONE || MOVE_FLAG(m) == EN_PASSANT;
+}
+
+// Most valuable victim first, and among those the least valuable attacker
+static inline int mvvLva(struct GameState *gs, Move m)
+{
+    int victim = (MOVE_FLAG(m) == EN_PASSANT) ? WP : gs->board[MOVE_TO(m)] % 6;
+    int attacker = gs->board[MOVE_FROM(m)] % 6;
+    return piece_value[victim] * 16 - piece_value[attacker] / 16;
+}
+
+// Static exchange evaluation: material won by side to move when it plays capture m
+// and both sides keep recapturing on the target square with their cheapest
+// attacker, either side free to stop. Sliders behind a capturer join in as
+// the occupancy empties (x-rays).
+int see(struct GameState *gs, Move m)
+{
+    static const int see_value[6] = {100, 500, 320, 330, 900, 20000}; // P R N B Q K
+    static const int cheapest_first[6] = {WP, WN, WB, WR, WQ, WK};
+    int from = MOVE_FROM(m), to = MOVE_TO(m);
+    int gain[32], d = 0;
+
+    Bitboard occ = gs->occupied_bb;
+    if (MOVE_FLAG(m) == EN_PASSANT)
     {
-        moveBishop(move);
+        occ ^= BIT(to + (gs->side ? 8 : -8));
+        gain[0] = see_value[WP];
     }
-    else if (board[move[0].x][move[0].y].recog == WQ || board[move[0].x][move[0].y].recog == BQ)
+    else
+        gain[0] = gs->board[to] != NONE ? see_value[gs->board[to] % 6] : 0;
+
+    int attacker = gs->board[from] % 6;
+    Bitboard from_bb = BIT(from);
+    int side = gs->side;
+    while (d < 31)
     {
-        moveQueen(move);
+        // the piece now on to is what the next capture wins
+        d++;
+        gain[d] = see_value[attacker] - gain[d - 1];
+
+        occ ^= from_bb;
+        side ^= 1;
+        Bitboard attackers = attackersTo(gs, to, occ) & occ & gs->color_bb[side];
+        if (!attackers)
+            break;
+        for (int i = 0; i < 6; i++)
+        {
+            Bitboard b = attackers & gs->piece_bb[cheapest_first[i] + (side ? 0 : BP)];
+            if (b)
+            {
+                attacker = cheapest_first[i];
+                from_bb = b & -b;
+                break;
+            }
+        }
     }
-    else if (board[move[0].x][move[0].y].recog == WK || board[move[0].x][move[0].y].recog == BK)
+    // either side may stop recapturing when that is better
+    while (--d)
+        gain[d - 1] = -(-gain[d - 1] > gain[d] ? -gain[d - 1] : gain[d]);
+    return gain[0];
+}
+
+// Give every move a sort key: hash move, captures by MVV-LVA and queen
+// promotions, killers, then quiet moves by history
+void scoreMoves(struct searchContext *ctx, struct moveList *list, int scores[], Move hash_move, int ply)
+{
+    struct GameState *gs = &ctx->pos;
+    for (int i = 0; i < list->count; i++)
     {
-        moveKing(move);
+        Move m = list->moves[i];
+        if (m == hash_move)
+            scores[i] = HASH_MOVE_SCORE;
+        else if (isCapture(gs, m))
+            scores[i] = CAPTURE_SCORE + mvvLva(gs, m);
+        else if (MOVE_FLAG(m) == PROMO_Q)
+            scores[i] = CAPTURE_SCORE;
+        else if (m == ctx->killers[ply][0])
+            scores[i] = KILLER_SCORE;
+        else if (m == ctx->killers[ply][1])
+            scores[i] = KILLER_SCORE - 1;
+        else
+            scores[i] = ctx->history[gs->side][MOVE_FROM(m)][MOVE_TO(m)];
     }
-    else
+}
+
+// Swap the best scored of the moves from i on into place i. Picking one move
+// at a time skips sorting the tail of the list when an early move cuts off.
+static inline void pickMove(struct moveList *list, int scores[], int i)
+{
+    int best = i;
+    for (int j = i + 1; j < list->count; j++)
+        if (scores[j] > scores[best])
+            best = j;
+    Move m = list->moves[i];
+    list->moves[i] = list->moves[best];
+    list->moves[best] = m;
+    int s = scores[i];
+    scores[i] = scores[best];
+    scores[best] = s;
+}
+
+enum PickStage
+{
+    STAGE_HASH,
+    STAGE_GEN_CAPTURES,
+    STAGE_CAPTURES,
+    STAGE_KILLERS,
+    STAGE_GEN_QUIETS,
+    STAGE_QUIETS,
+    STAGE_DONE
+};
+
+// Hands out the moves of one node a stage at a time, so quiet moves are only
+// generated once the hash move, the captures and the killers failed to cut off
+struct movePicker
+{
+    int stage;
+    int ply;
+    Move hash_move;
+    Move killers[2];
+    int index; // next move of list, or next killer
+    struct moveList list;
+    int scores[MAX_MOVES];
+};
+
+void initPicker(struct movePicker *mp, struct searchContext *ctx, Move hash_move, int ply)
+{
+    mp->stage = STAGE_HASH;
+    mp->ply = ply;
+    mp->hash_move = (hash_move && isLegalMove(&ctx->pos, hash_move)) ? hash_move : 0;
+    mp->killers[0] = ctx->killers[ply][0];
+    mp->killers[1] = ctx->killers[ply][1];
+    mp->index = 0;
+}
+
+// Next move to search, 0 once every legal move was handed out
+Move nextMove(struct searchContext *ctx, struct movePicker *mp)
+{
+    struct GameState *gs = &ctx->pos;
+    switch (mp->stage)
     {
-        printf("None");
+    case STAGE_HASH:
+        mp->stage = STAGE_GEN_CAPTURES;
+        if (mp->hash_move)
+            return mp->hash_move;
+        // fall through
+    case STAGE_GEN_CAPTURES:
+        generateMoves(gs, &mp->list, GEN_CAPTURES);
+        ctx->moves_generated += mp->list.count;
+        scoreMoves(ctx, &mp->list, mp->scores, mp->hash_move, mp->ply);
+        mp->index = 0;
+        mp->stage = STAGE_CAPTURES;
+        // fall through
+    case STAGE_CAPTURES:
+        while (mp->index < mp->list.count)
+        {
+            pickMove(&mp->list, mp->scores, mp->index);
+            Move m = mp->list.moves[mp->index++];
+            if (m != mp->hash_move)
+                return m;
+        }
+        mp->index = 0;
+        mp->stage = STAGE_KILLERS;
+        // fall through
+    case STAGE_KILLERS:
+        while (mp->index < 2)
+        {
+            Move m = mp->killers[mp->index++];
+            if (m && m != mp->hash_move && !isCapture(gs, m) && MOVE_FLAG(m) < PROMO_R && isLegalMove(gs, m))
+                return m;
+        }
+        mp->stage = STAGE_GEN_QUIETS;
+        // fall through
+    case STAGE_GEN_QUIETS:
+        generateMoves(gs, &mp->list, GEN_QUIETS);
+        ctx->moves_generated += mp->list.count;
+        scoreMoves(ctx, &mp->list, mp->scores, mp->hash_move, mp->ply);
+        mp->index = 0;
+        mp->stage = STAGE_QUIETS;
+        // fall through
+    case STAGE_QUIETS:
+        while (mp->index < mp->list.count)
+        {
+            pickMove(&mp->list, mp->scores, mp->index);
+            Move m = mp->list.moves[mp->index++];
+            if (m != mp->hash_move && m != mp->killers[0] && m != mp->killers[1])
+                return m;
+        }
+        mp->stage = STAGE_DONE;
     }
+    return 0;
 }
 
-void moveKing(struct coordinate move[])
+// A quiet move caused a cutoff: make it a killer at this ply and raise its history
+void rememberQuiet(struct searchContext *ctx, Move m, int depth, int ply)
 {
-    struct piece p = board[move[0].x][move[0].y];
+    if (ctx->killers[ply][0] != m)
+    {
+        ctx->killers[ply][1] = ctx->killers[ply][0];
+        ctx->killers[ply][0] = m;
+    }
 
-    if (move[0].x - 1 >= 0)
+    int *h = &ctx->history[ctx->pos.side][MOVE_FROM(m)][MOVE_TO(m)];
+    *h += depth * depth;
+    // keep history below the killer scores by halving the whole table
+    if (*h > KILLER_SCORE / 2)
     {
-        if (board[move[0].x - 1][move[0].y].color != p.color ||
-            board[move[0].x - 1][move[0].y].recog == NONE)
-        {
-            struct coordinate coord = {move[0].x - 1, move[0].y};
-            putMoveset(coord);
-        }
+        for (int c = 0; c < 2; c++)
+            for (int from = 0; from < 64; from++)
+                for (int to = 0; to < 64; to++)
+                    ctx->history[c][from][to] /= 2;
     }
+}
+/*---------------------- end move ordering -----------------------*/
 
-    if (move[0].x + 1 <= 7)
+// Count a node and report whether the search must unwind
+static inline bool nodeStop(struct searchContext *ctx)
+{
+    // reading the clock and the shared flag is slow, so only look every 1024 nodes
+    if ((++ctx->nodes & 1023) == 0)
     {
-        if (board[move[0].x + 1][move[0].y].color != p.color ||
-            board[move[0].x + 1][move[0].y].recog == NONE)
-        {
-            struct coordinate coord = {move[0].x + 1, move[0].y};
-            putMoveset(coord);
-        }
+        atomic_fetch_add_explicit(ctx->all_nodes, 1024, memory_order_relaxed);
+        if ((ctx->limits.movetime_ms && elapsedMs(ctx) >= ctx->limits.movetime_ms) ||
+            (ctx->limits.nodes && ctx->nodes >= ctx->limits.nodes))
+            atomic_store_explicit(ctx->stop, true, memory_order_relaxed);
+        if (atomic_load_explicit(ctx->stop, memory_order_relaxed))
+            ctx->stopped = true;
+    }
+    return ctx->stopped;
+}
+
+// Quiescence search: only captures and promotions are searched until the
+// position is quiet, and the side to move may stand pat on the static score.
+// In check every evasion is searched instead.
+int qsearch(struct searchContext *ctx, int alpha, int beta, int ply)
+{
+    struct GameState *gs = &ctx->pos;
+    ctx->qnodes++;
+    if (nodeStop(ctx))
+        return 0;
+
+    bool in_check = kingInCheck(gs, gs->side);
+    if (ply >= MAX_PLY - 1)
+        return evaluate(gs, &ctx->pawns);
+
+    int best = -INF_SCORE;
+    if (!in_check)
+    {
+        best = evaluate(gs, &ctx->pawns);
+        if (best >= beta)
+            return best;
+        if (best > alpha)
+            alpha = best;
     }
 
-    if (move[0].y - 1 >= 0)
+    struct moveList list;
+    int scores[MAX_MOVES];
+    generateMoves(gs, &list, in_check ? GEN_ALL : GEN_CAPTURES);
+    ctx->moves_generated += list.count;
+    if (in_check && list.count == 0)
+        return -MATE_SCORE + ply;
+    scoreMoves(ctx, &list, scores, 0, ply);
+
+    for (int i = 0; i < list.count; i++)
     {
-        if (board[move[0].x][move[0].y - 1].color != p.color ||
-            board[move[0].x][move[0].y - 1].recog == NONE)
+        pickMove(&list, scores, i);
+        Move m = list.moves[i];
+        // a capture that loses material cannot raise alpha over the stand-pat score
+        if (!in_check && MOVE_FLAG(m) < PROMO_R && see(gs, m) < 0)
         {
-            struct coordinate coord = {move[0].x, move[0].y - 1};
-            putMoveset(coord);
+            ctx->see_pruned++;
+            continue;
         }
+
+        make_move(gs, m);
+        int score = -qsearch(ctx, -beta, -alpha, ply + 1);
+        unmake_move(gs);
+        if (ctx->stopped)
+            return 0;
+
+        if (score > best)
+            best = score;
+        if (score > alpha)
+            alpha = score;
+        if (alpha >= beta)
+            break;
     }
+    return best;
+}
 
-    if (move[0].y + 1 <= 7)
+// Parse one "--no-<technique>" switch, e.g. --no-lmr; false if arg is not one
+bool parseSearchOption(const char *arg)
+{
+    static const char *names[5] = {"--no-nullmove", "--no-lmr", "--no-pvs", "--no-aspiration", "--no-futility"};
+    bool *flags[5] = {&search_options.null_move, &search_options.lmr, &search_options.pvs,
+                      &search_options.aspiration, &search_options.futility};
+    for (int i = 0; i < 5; i++)
     {
-        if (board[move[0].x][move[0].y + 1].color != p.color ||
-            board[move[0].x][move[0].y + 1].recog == NONE)
+        if (strcmp(arg, names[i]) == 0)
         {
-            struct coordinate coord = {move[0].x, move[0].y + 1};
-            putMoveset(coord);
+            *flags[i] = false;
+            return true;
         }
     }
+    return false;
+}
+
+// Negamax with alpha-beta pruning, PVS and selective pruning (see searchOptions);
+// returns the score for the side to move
+int negamax(struct searchContext *ctx, int depth, int alpha, int beta, int ply)
+{
+    struct GameState *gs = &ctx->pos;
+
+    if (depth <= 0)
+        return qsearch(ctx, alpha, beta, ply);
+    if (nodeStop(ctx))
+        return 0;
+
+    if (ply > 0 && (gs->halfmove >= 100 || isRepetition(gs)))
+        return 0;
+
+    // a stored result that is deep enough and bounds the score on the right
+    // side ends the node; otherwise its move is still the best guess to try first
+    Move hash_move = 0;
+    struct ttEntry e;
+    if (ctx->tt && ttProbe(ctx->tt, gs->key, &e))
+    {
+        hash_move = e.move;
+        int score = scoreFromTT(e.score, ply);
+        if (ply > 0 && e.depth >= depth &&
+            (e.bound == BOUND_EXACT ||
+             (e.bound == BOUND_LOWER && score >= beta) ||
+             (e.bound == BOUND_UPPER && score <= alpha)))
+            return score;
+    }
+    // at the root, the best move of the previous iteration
+    if (ply == 0 && ctx->best_move)
+        hash_move = ctx->best_move;
+
+    bool pv_node = beta - alpha > 1;
+    bool in_check = kingInCheck(gs, gs->side);
+    int static_eval = in_check ? -INF_SCORE : evaluate(gs, &ctx->pawns);
+    const struct searchOptions *opt = &search_options;
+
+    // null move: if passing still fails high, a real move will too. Skipped when
+    // only pawns are left, where passing can be the best move (zugzwang), and
+    // right after another null move.
+    Bitboard own = gs->color_bb[gs->side];
+    Bitboard pawns_and_king = gs->piece_bb[gs->side ? WP : BP] | gs->piece_bb[gs->side ? WK : BK];
+    if (opt->null_move && !pv_node && !in_check && ply > 0 && depth >= 3 && static_eval >= beta &&
+        (own & ~pawns_and_king) && gs->undo_stack[gs->ply - 1].move != 0)
+    {
+        int r = depth > 6 ? 3 : 2;
+        make_null_move(gs);
+        int score = -negamax(ctx, depth - 1 - r, -beta, -beta + 1, ply + 1);
+        unmake_null_move(gs);
+        if (ctx->stopped)
+            return 0;
+        if (score >= beta)
+            return score >= MATE_SCORE - MAX_PLY ? beta : score;
+    }
+
+    // futility: near the leaves, quiet moves cannot lift a hopeless static score over alpha
+    bool futile = opt->futility && !pv_node && !in_check && depth <= 2 &&
+                  static_eval + 150 * depth <= alpha && abs(alpha) < MATE_SCORE - MAX_PLY;
 
-    if (move[0].x - 1 >= 0 && move[0].y - 1 >= 0)
+    struct movePicker mp;
+    initPicker(&mp, ctx, hash_move, ply);
+
+    int alpha_start = alpha;
+    int best = -INF_SCORE;
+    Move best_move = 0;
+    int searched = 0;
+    Move m;
+    while ((m = nextMove(ctx, &mp)))
     {
-        if (board[move[0].x - 1][move[0].y - 1].color != p.color ||
-            board[move[0].x - 1][move[0].y - 1].recog == NONE)
+        searched++;
+        bool quiet = !isCapture(gs, m) && MOVE_FLAG(m) < PROMO_R;
+        int history = ctx->history[gs->side][MOVE_FROM(m)][MOVE_TO(m)];
+        make_move(gs, m);
+        bool gives_check = kingInCheck(gs, gs->side);
+
+        if (futile && quiet && !gives_check && searched > 1)
+        {
+            unmake_move(gs);
+            if (best < static_eval + 150 * depth)
+                best = static_eval + 150 * depth;
+            continue;
+        }
+
+        int score;
+        if (searched == 1)
+            score = -negamax(ctx, depth - 1, -beta, -alpha, ply + 1);
+        else
         {
-            struct coordinate coord = {move[0].x - 1, move[0].y - 1};
-            putMoveset(coord);
+            // late quiet moves, ordered last by history, get a shallower look first;
+            // ones that never caused a cutoff are reduced further
+            int r = 0;
+            if (opt->lmr && depth >= 3 && quiet && !in_check && !gives_check && mp.stage == STAGE_QUIETS && searched > 3)
+            {
+                r = 1 + (searched > 10) + (history <= 0);
+                if (r > depth - 2)
+                    r = depth - 2;
+            }
+
+            // PVS: later moves only have to prove they are no better than alpha
+            int window = opt->pvs ? alpha + 1 : beta;
+            score = -negamax(ctx, depth - 1 - r, -window, -alpha, ply + 1);
+            if (r > 0 && score > alpha)
+                score = -negamax(ctx, depth - 1, -window, -alpha, ply + 1);
+            if (opt->pvs && score > alpha && score < beta)
+                score = -negamax(ctx, depth - 1, -beta, -alpha, ply + 1);
+        }
+        unmake_move(gs);
+        if (ctx->stopped)
+            return 0;
+
+        if (score > best)
+        {
+            best = score;
+            best_move = m;
+            if (ply == 0)
+                ctx->root_best = best_move;
+        }
+        if (score > alpha)
+            alpha = score;
+        if (alpha >= beta)
+        {
+            ctx->cutoffs++;
+            if (searched == 1)
+                ctx->first_move_cutoffs++;
+            if (quiet)
+                rememberQuiet(ctx, best_move, depth, ply);
+            break;
         }
     }
+    if (searched == 0)
+        return kingInCheck(gs, gs->side) ? -MATE_SCORE + ply : 0;
+
+    if (ctx->tt)
+    {
+        int bound = best >= beta ? BOUND_LOWER : best > alpha_start ? BOUND_EXACT : BOUND_UPPER;
+        ttStore(ctx->tt, gs->key, depth, bound, best, bound == BOUND_UPPER ? 0 : best_move, ply);
+    }
+    return best;
+}
+
+// UCI progress line for the iteration thread 0 just completed. The principal
+// variation is the best move followed by the hash moves after it.
+static void printInfo(struct searchContext *ctx)
+{
+    int64_t ms = elapsedMs(ctx);
+    int score = ctx->best_score;
+    // every thread's nodes, plus the ones of this thread not yet added
+    uint64_t nodes = atomic_load_explicit(ctx->all_nodes, memory_order_relaxed) + (ctx->nodes & 1023);
+    printf("info depth %d ", ctx->depth_done);
+    if (abs(score) >= MATE_SCORE - MAX_DEPTH)
+        printf("score mate %d ", score > 0 ? (MATE_SCORE - score + 1) / 2 : -(MATE_SCORE + score) / 2);
+    else
+        printf("score cp %d ", score);
+    printf("nodes %llu nps %llu time %lld pv", (unsigned long long)nodes,
+           (unsigned long long)(ms > 0 ? nodes * 1000 / ms : 0), (long long)ms);
+
+    struct GameState pos = ctx->pos;
+    Move m = ctx->best_move;
+    for (int i = 0; i < ctx->depth_done && m && isLegalMove(&pos, m); i++)
+    {
+        char name[6];
+        moveToString(m, name);
+        printf(" %s", name);
+        make_move(&pos, m);
+        struct ttEntry entry;
+        m = (ctx->tt && ttProbe(ctx->tt, pos.key, &entry)) ? entry.move : 0;
+    }
+    printf("\n");
+    fflush(stdout);
+}
 
-    if (move[0].x + 1 <= 7 && move[0].y + 1 <= 7)
+// Iterative deepening: search first_depth, first_depth + 1, ... until the
+// depth or time limit is reached, keeping the result of the last finished iteration
+static void iterate(struct searchContext *ctx, int first_depth)
+{
+    int max_depth = (ctx->limits.depth > 0 && ctx->limits.depth < MAX_DEPTH) ? ctx->limits.depth : MAX_DEPTH;
+    for (int depth = first_depth; depth <= max_depth; depth++)
     {
-        if (board[move[0].x + 1][move[0].y + 1].color != p.color ||
-            board[move[0].x + 1][move[0].y + 1].recog == NONE)
+        // aspiration: expect the score near the last one and widen the window
+        // on either side whenever the result falls outside it
+        int delta = 25;
+        int alpha = -INF_SCORE, beta = INF_SCORE;
+        if (search_options.aspiration && depth >= 5)
+        {
+            alpha = ctx->best_score - delta;
+            beta = ctx->best_score + delta;
+        }
+        int score;
+        while (true)
         {
-            struct coordinate coord = {move[0].x + 1, move[0].y + 1};
-            putMoveset(coord);
+            score = negamax(ctx, depth, alpha, beta, 0);
+            if (ctx->stopped || (score > alpha && score < beta))
+                break;
+            delta *= 2;
+            if (score <= alpha)
+                alpha = (delta > 500) ? -INF_SCORE : score - delta;
+            else
+                beta = (delta > 500) ? INF_SCORE : score + delta;
         }
+        if (ctx->stopped)
+            break;
+
+        ctx->best_move = ctx->root_best;
+        ctx->best_score = score;
+        ctx->depth_done = depth;
+        if (ctx->id == 0 && ctx->limits.info)
+            printInfo(ctx);
+
+        // a found mate will not get any shorter, and the next iteration
+        // takes longer than everything so far, so stop once half the time is used
+        if (abs(score) >= MATE_SCORE - MAX_DEPTH)
+            break;
+        if (ctx->limits.movetime_ms && elapsedMs(ctx) * 2 >= ctx->limits.movetime_ms)
+            break;
+    }
+}
+
+// Lazy SMP helper: searches the same root, half of them one ply deeper, and
+// only contributes through the entries it leaves in the shared table
+void *searchHelper(void *arg)
+{
+    struct searchContext *ctx = arg;
+    iterate(ctx, 1 + (ctx->id & 1));
+    return NULL;
+}
+
+// Search gs for the side to move on threads threads. ctx belongs to the
+// calling thread and holds the result and the node count of all threads.
+Move searchBestMove(struct searchContext *ctx, const struct GameState *gs, const struct searchLimits *limits, struct transTable *tt, int threads)
+{
+    ctx->pos = *gs;
+    ctx->pos.ply = 0;
+    ctx->limits = *limits;
+    ctx->tt = (tt && tt->slots) ? tt : NULL;
+    ctx->nodes = 0;
+    ctx->all_nodes = &ctx->all_nodes_count;
+    atomic_store(&ctx->all_nodes_count, 0);
+    ctx->id = 0;
+    // an outside flag is cleared by its owner, so a stop sent before the
+    // search got going is not lost
+    ctx->stop = limits->stop ? limits->stop : &ctx->stop_flag;
+    if (!limits->stop)
+        atomic_store(&ctx->stop_flag, false);
+    ctx->stopped = false;
+    ctx->best_move = 0;
+    ctx->best_score = 0;
+    ctx->depth_done = 0;
+    ctx->root_best = 0;
+    ctx->cutoffs = 0;
+    ctx->first_move_cutoffs = 0;
+    ctx->moves_generated = 0;
+    ctx->qnodes = 0;
+    ctx->see_pruned = 0;
+    memset(ctx->killers, 0, sizeof(ctx->killers));
+    memset(ctx->history, 0, sizeof(ctx->history));
+    memset(&ctx->pawns, 0, sizeof(ctx->pawns));
+    clock_gettime(CLOCK_MONOTONIC, &ctx->start);
+
+    // without a shared table the helpers could not pass anything on
+    if (threads < 1 || !ctx->tt)
+        threads = 1;
+    struct searchContext *helpers = malloc(sizeof(struct searchContext) * (threads - 1));
+    pthread_t *ids = malloc(sizeof(pthread_t) * (threads - 1));
+    // copy ctx for every helper before any of them starts writing to the
+    // stop flag and node counter that live in it
+    for (int t = 0; t < threads - 1; t++)
+    {
+        helpers[t] = *ctx;
+        helpers[t].id = t + 1;
     }
+    for (int t = 0; t < threads - 1; t++)
+        pthread_create(&ids[t], NULL, searchHelper, &helpers[t]);
 
-    if (move[0].x + 1 <= 7 && move[0].y - 1 >= 0)
+    iterate(ctx, 1);
+
+    atomic_store(ctx->stop, true);
+    for (int t = 0; t < threads - 1; t++)
     {
-        if (board[move[0].x + 1][move[0].y - 1].color != p.color ||
-            board[move[0].x + 1][move[0].y - 1].recog == NONE)
-        {
-            struct coordinate coord = {move[0].x + 1, move[0].y - 1};
-            putMoveset(coord);
+        pthread_join(ids[t], NULL);
+        ctx->nodes += helpers[t].nodes;
+        ctx->cutoffs += helpers[t].cutoffs;
+        ctx->first_move_cutoffs += helpers[t].first_move_cutoffs;
+        ctx->moves_generated += helpers[t].moves_generated;
+        ctx->qnodes += helpers[t].qnodes;
+        ctx->see_pruned += helpers[t].see_pruned;
+        ctx->pawns.probes += helpers[t].pawns.probes;
+        ctx->pawns.hits += helpers[t].pawns.hits;
+    }
+    free(helpers);
+    free(ids);
+
+    // out of time before depth 1 finished: play any legal move
+    if (!ctx->best_move)
+    {
+        struct moveList list;
+        if (generateLegal(&ctx->pos, &list) > 0)
+            ctx->best_move = list.moves[0];
+    }
+    return ctx->best_move;
+}
+/*---------------------- end search -----------------------*/
+
+/*-------------------------- PGN --------------------------*/
+
+#define PGN_BATCH 1024 // games replayed per round, shared out between the threads
+
+enum PgnStatus
+{
+    PGN_OK,
+    PGN_BAD_FEN,   // the FEN tag could not be loaded
+    PGN_ILLEGAL,   // no legal move matches a move of the movetext
+    PGN_AMBIGUOUS  // several legal moves match it
+};
+
+// One game of the file. The text stays in the mapping; nothing is copied out.
+struct pgnGame
+{
+    const char *start, *end; // tag pairs and movetext
+
+    // filled in by replayGame()
+    int status;           // PgnStatus
+    int plies;            // moves replayed
+    const char *bad_move; // the move that failed, bad_len characters long
+    int bad_len;
+    const char *result; // game termination marker, NULL if there is none
+    int result_len;
+    uint64_t key; // Zobrist key of the last position reached
+};
+
+struct pgnJob
+{
+    struct pgnGame *games;
+    int ngames;
+    atomic_int next; // next game to hand out
+};
+
+// The legal move a SAN token such as "Nbd7", "exd8=Q+" or "O-O-O" stands for,
+// 0 if there is none. *ambiguous is set when several legal moves match.
+Move sanToMove(struct GameState *gs, const char *san, int len, bool *ambiguous)
+{
+    *ambiguous = false;
+
+    // check marks and annotation symbols do not change the move
+    while (len > 0 && (san[len - 1] == '+' || san[len - 1] == '#' || san[len - 1] == '!' || san[len - 1] == '?'))
+        len--;
+    if (len < 2)
+        return 0;
+
+    struct moveList legal;
+    generateLegal(gs, &legal);
+
+    // castling, also written with zeros
+    if (san[0] == 'O' || san[0] == '0')
+    {
+        int to_col = (len >= 5) ? 2 : 6;
+        for (int i = 0; i < legal.count; i++)
+            if (MOVE_FLAG(legal.moves[i]) == CASTLE && MOVE_TO(legal.moves[i]) % 8 == to_col)
+                return legal.moves[i];
+        return 0;
+    }
+
+    const char *types = "PRNBQK"; // PieceType order
+    int type = WP, i = 0;
+    if (strchr("RNBQK", san[0]))
+    {
+        type = (int)(strchr(types, san[0]) - types);
+        i = 1;
+    }
+
+    // promotion piece, "=Q" or just "Q"
+    int promo = 0;
+    const char *promos = "RNBQ"; // PROMO_R.. order
+    if (type == WP && strchr(promos, san[len - 1]))
+    {
+        promo = PROMO_R + (int)(strchr(promos, san[len - 1]) - promos);
+        len--;
+        if (len > 0 && san[len - 1] == '=')
+            len--;
+    }
+    if (len - i < 2)
+        return 0;
+
+    int to_col = san[len - 2] - 'a';
+    int to_row = '8' - san[len - 1];
+    if (to_col < 0 || to_col > 7 || to_row < 0 || to_row > 7)
+        return 0;
+
+    // whatever is left between the piece and the target: disambiguation, capture
+    int from_col = -1, from_row = -1;
+    for (int k = i; k < len - 2; k++)
+    {
+        if (san[k] >= 'a' && san[k] <= 'h')
+            from_col = san[k] - 'a';
+        else if (san[k] >= '1' && san[k] <= '8')
+            from_row = '8' - san[k];
+        else if (san[k] != 'x' && san[k] != ':')
+            return 0;
+    }
+
+    Move found = 0;
+    int matches = 0;
+    for (int m = 0; m < legal.count; m++)
+    {
+        Move mv = legal.moves[m];
+        int from = MOVE_FROM(mv), flag = MOVE_FLAG(mv);
+        if (gs->board[from] % 6 != type || MOVE_TO(mv) != SQUARE(to_row, to_col) || flag == CASTLE)
+            continue;
+        if ((from_col >= 0 && from % 8 != from_col) || (from_row >= 0 && from / 8 != from_row))
+            continue;
+        if (promo ? flag != promo : flag >= PROMO_R)
+            continue;
+        found = mv;
+        matches++;
+    }
+    *ambiguous = matches > 1;
+    return matches == 1 ? found : 0;
+}
+
+static bool isResult(const char *tok, int len)
+{
+    return (len == 3 && (strncmp(tok, "1-0", 3) == 0 || strncmp(tok, "0-1", 3) == 0)) ||
+           (len == 7 && strncmp(tok, "1/2-1/2", 7) == 0) || (len == 1 && tok[0] == '*');
+}
+
+// Replay one game through the legal move generator, stopping at the first move
+// that does not match exactly one legal move
+void replayGame(struct pgnGame *g)
+{
+    struct GameState gs;
+    init(&gs);
+    g->status = PGN_OK;
+    g->plies = 0;
+    g->result = NULL;
+
+    const char *p = g->start, *end = g->end;
+
+    // tag pairs; only FEN matters for the replay
+    while (p < end)
+    {
+        while (p < end && isspace((unsigned char)*p))
+            p++;
+        if (p == end || *p != '[')
+            break;
+        const char *eol = memchr(p, '\n', end - p);
+        if (!eol)
+            eol = end;
+        if (eol - p > 6 && strncmp(p, "[FEN \"", 6) == 0)
+        {
+            const char *quote = memchr(p + 6, '"', eol - p - 6);
+            int n = quote ? (int)(quote - p - 6) : 0;
+            char fen[MAX_FEN];
+            if (n >= MAX_FEN)
+                n = 0;
+            memcpy(fen, p + 6, n);
+            fen[n] = '\0';
+            if (loadFEN(&gs, fen) < 0)
+            {
+                g->status = PGN_BAD_FEN;
+                g->key = 0;
+                return;
+            }
         }
+        p = eol;
     }
 
-    if (move[0].x - 1 >= 0 && move[0].y + 1 <= 7)
+    // movetext
+    int variation = 0; // nesting depth of ( ) variations, which are skipped
+    while (p < end)
     {
-        if (board[move[0].x - 1][move[0].y + 1].color != p.color ||
-            board[move[0].x - 1][move[0].y + 1].recog == NONE)
+        char c = *p;
+        if (isspace((unsigned char)c))
+            p++;
+        else if (c == '{')
+        {
+            const char *close = memchr(p, '}', end - p);
+            p = close ? close + 1 : end;
+        }
+        else if (c == ';' || c == '%')
+        {
+            const char *eol = memchr(p, '\n', end - p);
+            p = eol ? eol + 1 : end;
+        }
+        else if (c == '(' || c == ')')
+        {
+            variation += (c == '(') ? 1 : (variation > 0 ? -1 : 0);
+            p++;
+        }
+        else
         {
-            struct coordinate coord = {move[0].x - 1, move[0].y + 1};
-            putMoveset(coord);
+            const char *tok = p;
+            while (p < end && !isspace((unsigned char)*p) && *p != '{' && *p != '(' && *p != ')' && *p != ';')
+                p++;
+            int len = (int)(p - tok);
+            if (variation > 0 || tok[0] == '$')
+                continue;
+            if (isResult(tok, len))
+            {
+                g->result = tok;
+                g->result_len = len;
+                continue;
+            }
+
+            // move numbers, "12." or "12...", possibly glued to the move
+            const char *dot = tok;
+            for (const char *q = tok; q < p; q++)
+                if (*q == '.')
+                    dot = q + 1;
+            len -= (int)(dot - tok);
+            tok = dot;
+            if (len == 0)
+                continue;
+
+            bool ambiguous;
+            Move m = sanToMove(&gs, tok, len, &ambiguous);
+            if (!m)
+            {
+                g->status = ambiguous ? PGN_AMBIGUOUS : PGN_ILLEGAL;
+                g->bad_move = tok;
+                g->bad_len = len;
+                break;
+            }
+            make_move(&gs, m);
+            gs.ply = 0; // no going back, keep the undo stack from filling up
+            g->plies++;
         }
     }
+    g->key = gs.key;
 }
 
-void moveQueen(struct coordinate move[])
+void *pgnWorker(void *arg)
 {
+    struct pgnJob *job = arg;
+    int i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->ngames)
+        replayGame(&job->games[i]);
+    return NULL;
+}
 
-    struct piece p = board[move[0].x][move[0].y];
-
-    if (move[0].x - 1 >= 0)
+// Start of the game after the one at p: the next tag pair line that follows movetext
+static const char *nextGame(const char *p, const char *end)
+{
+    bool movetext = false;
+    while (p < end)
     {
-        if (board[move[0].x - 1][move[0].y].color != p.color ||
-            board[move[0].x - 1][move[0].y].recog == NONE)
-        {
-            struct coordinate coord = {move[0].x - 1, move[0].y};
-            putMoveset(coord);
-        }
+        const char *eol = memchr(p, '\n', end - p);
+        eol = eol ? eol + 1 : end;
+        const char *q = p;
+        while (q < eol && (*q == ' ' || *q == '\t'))
+            q++;
+        if (q < eol && *q == '[' && movetext)
+            return p;
+        if (q < eol && *q != '[' && !isspace((unsigned char)*q))
+            movetext = true;
+        p = eol;
     }
+    return end;
+}
 
-    if (move[0].x + 1 <= 7)
+// "pgn <file>" mode: replay every game of the file and print one line per game,
+// then a hash over the final positions of all games. The file is mapped and read
+// front to back; pages are dropped once their games are done, so files larger
+// than memory stream through.
+int runPgn(const char *path, int threads)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
     {
-        if (board[move[0].x + 1][move[0].y].color != p.color ||
-            board[move[0].x + 1][move[0].y].recog == NONE)
-        {
-            struct coordinate coord = {move[0].x + 1, move[0].y};
-            putMoveset(coord);
-        }
+        perror(path);
+        return 1;
     }
-
-    if (move[0].y - 1 >= 0)
+    struct stat st;
+    if (fstat(fd, &st) < 0)
     {
-        if (board[move[0].x][move[0].y - 1].color != p.color ||
-            board[move[0].x][move[0].y - 1].recog == NONE)
-        {
-            struct coordinate coord = {move[0].x, move[0].y - 1};
-            putMoveset(coord);
-        }
+        perror(path);
+        close(fd);
+        return 1;
     }
-
-    if (move[0].y + 1 <= 7)
+    size_t size = (size_t)st.st_size;
+    const char *data = NULL;
+    if (size > 0)
     {
-        if (board[move[0].x][move[0].y + 1].color != p.color ||
-            board[move[0].x][move[0].y + 1].recog == NONE)
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
         {
-            struct coordinate coord = {move[0].x, move[0].y + 1};
-            putMoveset(coord);
+            perror(path);
+            close(fd);
+            return 1;
         }
+        madvise((void *)data, size, MADV_SEQUENTIAL);
     }
+    if (threads < 1)
+        threads = 1;
 
-    if (move[0].x - 1 >= 0 && move[0].y - 1 >= 0)
-    {
-        if (board[move[0].x - 1][move[0].y - 1].color != p.color ||
-            board[move[0].x - 1][move[0].y - 1].recog == NONE)
-        {
-            struct coordinate coord = {move[0].x - 1, move[0].y - 1};
-            putMoveset(coord);
-        }
-    }
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-    if (move[0].x + 1 <= 7 && move[0].y + 1 <= 7)
-    {
-        if (board[move[0].x + 1][move[0].y + 1].color != p.color ||
-            board[move[0].x + 1][move[0].y + 1].recog == NONE)
-        {
-            struct coordinate coord = {move[0].x + 1, move[0].y + 1};
-            putMoveset(coord);
-        }
-    }
+    struct pgnGame *games = malloc(sizeof(struct pgnGame) * PGN_BATCH);
+    pthread_t *workers = malloc(sizeof(pthread_t) * threads);
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const char *p = data, *end = data + size, *released = data;
+    uint64_t hash = 0xcbf29ce484222325ULL; // FNV-1a over the final keys, in file order
+    uint64_t ngames = 0, errors = 0, plies = 0;
 
-    if (move[0].x + 1 <= 7 && move[0].y - 1 >= 0)
+    while (p < end)
     {
-        if (board[move[0].x + 1][move[0].y - 1].color != p.color ||
-            board[move[0].x + 1][move[0].y - 1].recog == NONE)
-        {
-            struct coordinate coord = {move[0].x + 1, move[0].y - 1};
-            putMoveset(coord);
+        struct pgnJob job = {.games = games};
+        atomic_init(&job.next, 0);
+        while (job.ngames < PGN_BATCH && p < end)
+        {
+            const char *next = nextGame(p, end);
+            const char *q = p;
+            while (q < next && isspace((unsigned char)*q))
+                q++;
+            if (q < next)
+                games[job.ngames++] = (struct pgnGame){.start = q, .end = next};
+            p = next;
+        }
+
+        for (int t = 1; t < threads; t++)
+            pthread_create(&workers[t], NULL, pgnWorker, &job);
+        pgnWorker(&job);
+        for (int t = 1; t < threads; t++)
+            pthread_join(workers[t], NULL);
+
+        for (int i = 0; i < job.ngames; i++)
+        {
+            struct pgnGame *g = &games[i];
+            ngames++;
+            plies += g->plies;
+            hash = (hash ^ g->key) * 0x100000001b3ULL;
+            if (g->status == PGN_OK)
+                printf("Game %llu: %d plies, %.*s, key %016llx\n", (unsigned long long)ngames, g->plies,
+                       g->result ? g->result_len : 9, g->result ? g->result : "no result", (unsigned long long)g->key);
+            else
+            {
+                errors++;
+                if (g->status == PGN_BAD_FEN)
+                    printf("Game %llu: invalid FEN tag\n", (unsigned long long)ngames);
+                else
+                    printf("Game %llu: %s move %.*s after %d plies\n", (unsigned long long)ngames,
+                           g->status == PGN_AMBIGUOUS ? "ambiguous" : "illegal", g->bad_len, g->bad_move, g->plies);
+            }
         }
-    }
 
-    if (move[0].x - 1 >= 0 && move[0].y + 1 <= 7)
-    {
-        if (board[move[0].x - 1][move[0].y + 1].color != p.color ||
-            board[move[0].x - 1][move[0].y + 1].recog == NONE)
+        // every page before p has been replayed and printed
+        const char *done = data + (size_t)(p - data) / page * page;
+        if (done > released)
         {
-            struct coordinate coord = {move[0].x - 1, move[0].y + 1};
-            putMoveset(coord);
+            madvise((void *)released, done - released, MADV_DONTNEED);
+            released = done;
         }
     }
 
-    moveRook(move);
-    moveBishop(move);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    double seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Games: %llu (%llu with errors), %llu plies\n", (unsigned long long)ngames,
+           (unsigned long long)errors, (unsigned long long)plies);
+    printf("Hash: %016llx\n", (unsigned long long)hash);
+    printf("Time: %.3f s (%.0f games/s)\n", seconds, seconds > 0 ? ngames / seconds : 0.0);
+
+    free(games);
+    free(workers);
+    if (data)
+        munmap((void *)data, size);
+    close(fd);
+    return errors ? 2 : 0;
 }
+/*---------------------- end pgn -----------------------*/
+
+/*-------------------------- EPD --------------------------*/
 
-void moveBishop(struct coordinate move[])
+// One line of an EPD file and what searching it gave
+struct epdPosition
 {
+    char *line; // four FEN fields, then operations such as bm Nf3; id "x";
+    bool valid;
+    bool has_bm;
+    bool solved; // the best move is one of the bm moves
+    Move best;
+    int score;
+    int depth;
+    uint64_t nodes;
+    bool done; // guarded by epdJob.lock
+};
 
-    struct piece p = board[move[0].x][move[0].y];
+struct epdJob
+{
+    struct epdPosition *positions;
+    int count;
+    atomic_int next; // next position to hand out
+    struct searchLimits limits;
+    int hash_mb; // per thread
+    pthread_mutex_t lock;
+    pthread_cond_t done_cond; // a position was finished
+};
 
-    for (int i = move[0].x + 1, j = move[0].y + 1; i <= 7 && j <= 7; i++, j++)
+// Operation op of an EPD line, e.g. "bm" for "... bm Nf3 Ng5; id \"x\";", as
+// a pointer to its operands and their length. NULL if the line has none.
+static const char *epdOperation(const char *line, const char *op, int *len)
+{
+    // the operations start after the four FEN fields
+    const char *p = line;
+    for (int field = 0; field < 4 && *p; field++)
     {
+        p += strspn(p, " \t");
+        p += strcspn(p, " \t");
+    }
 
-        if (board[i][j].recog == NONE)
-        {
-            struct coordinate coord = {i, j};
-
-            putMoveset(coord);
-        }
-        else if (board[i][j].color != p.color)
-        {
-            struct coordinate coord = {i, j};
-            putMoveset(coord);
-            break;
-        }
-        else
+    size_t n = strlen(op);
+    while (*p)
+    {
+        p += strspn(p, " \t");
+        const char *end = strchr(p, ';');
+        if (!end)
+            end = p + strlen(p);
+        if (strncmp(p, op, n) == 0 && (p[n] == ' ' || p[n] == '\t'))
         {
-            break;
+            p += n + strspn(p + n, " \t");
+            *len = (int)(end - p);
+            return p;
         }
+        p = *end ? end + 1 : end;
     }
+    return NULL;
+}
 
-    for (int i = move[0].x - 1, j = move[0].y - 1; i >= 0 && j >= 0; i--, j--)
+// Worker thread: one engine context and transposition table of its own, reused
+// for every position it takes
+void *epdWorker(void *arg)
+{
+    struct epdJob *job = arg;
+    struct searchContext *ctx = malloc(sizeof(struct searchContext));
+    struct transTable tt = {0};
+    if (job->hash_mb > 0)
+        initTransTable(&tt, job->hash_mb);
+    struct GameState gs;
+    init(&gs);
+
+    int i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->count)
     {
-
-        if (board[i][j].recog == NONE)
-        {
-            struct coordinate coord = {i, j};
-            putMoveset(coord);
-        }
-        else if (board[i][j].color != p.color)
-        {
-            struct coordinate coord = {i, j};
-            putMoveset(coord);
-            break;
-        }
-        else
-        {
-            break;
+        struct epdPosition *e = &job->positions[i];
+        e->valid = loadFEN(&gs, e->line) >= 0;
+        if (e->valid)
+        {
+            // a fresh table each time, so results do not depend on which
+            // positions a thread happened to search before
+            clearTransTable(&tt);
+            e->best = searchBestMove(ctx, &gs, &job->limits, &tt, 1);
+            e->score = ctx->best_score;
+            e->depth = ctx->depth_done;
+            e->nodes = ctx->nodes;
+
+            int len;
+            const char *bm = epdOperation(e->line, "bm", &len);
+            e->has_bm = bm != NULL;
+            for (const char *p = bm, *end = bm + len; bm && p < end;)
+            {
+                const char *tok = p;
+                while (p < end && *p != ' ')
+                    p++;
+                bool ambiguous;
+                if (p > tok && sanToMove(&gs, tok, (int)(p - tok), &ambiguous) == e->best && e->best)
+                    e->solved = true;
+                while (p < end && *p == ' ')
+                    p++;
+            }
         }
+
+        pthread_mutex_lock(&job->lock);
+        e->done = true;
+        pthread_cond_broadcast(&job->done_cond);
+        pthread_mutex_unlock(&job->lock);
     }
 
-    for (int i = move[0].x - 1, j = move[0].y + 1; i >= 0 && j <= 7; i--, j++)
+    free(ctx);
+    freeTransTable(&tt);
+    return NULL;
+}
+
+// "epd <file>" mode: search every position of the file on a pool of threads and
+// print the best move and score of each in file order, as soon as it and all the
+// positions before it are done
+int runEpd(const char *path, const struct searchLimits *limits, int threads, int hash_mb)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
     {
+        perror(path);
+        return 1;
+    }
 
-        if (board[i][j].recog == NONE)
-        {
-            struct coordinate coord = {i, j};
-            putMoveset(coord);
-        }
-        else if (board[i][j].color != p.color)
-        {
-            struct coordinate coord = {i, j};
-            putMoveset(coord);
-            break;
-        }
-        else
+    struct epdJob job = {0};
+    int cap = 0;
+    char *line = NULL;
+    size_t line_cap = 0;
+    while (getline(&line, &line_cap, f) >= 0)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[strspn(line, " \t")] == '\0')
+            continue;
+        if (job.count == cap)
         {
-            break;
+            cap = cap ? cap * 2 : 1024;
+            job.positions = realloc(job.positions, sizeof(struct epdPosition) * cap);
         }
+        job.positions[job.count++] = (struct epdPosition){.line = strdup(line)};
     }
-
-    for (int i = move[0].x + 1, j = move[0].y - 1; i <= 7 && j >= 0; i++, j--)
+    free(line);
+    fclose(f);
+
+    job.limits = *limits;
+    job.hash_mb = hash_mb;
+    atomic_init(&job.next, 0);
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.done_cond, NULL);
+    if (threads > job.count)
+        threads = job.count;
+    if (threads < 1)
+        threads = 1;
+
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pthread_t *workers = malloc(sizeof(pthread_t) * threads);
+    for (int t = 0; t < threads; t++)
+        pthread_create(&workers[t], NULL, epdWorker, &job);
+
+    uint64_t nodes = 0;
+    int invalid = 0, with_bm = 0, solved = 0;
+    for (int i = 0; i < job.count; i++)
     {
+        struct epdPosition *e = &job.positions[i];
+        pthread_mutex_lock(&job.lock);
+        while (!e->done)
+            pthread_cond_wait(&job.done_cond, &job.lock);
+        pthread_mutex_unlock(&job.lock);
 
-        if (board[i][j].recog == NONE)
+        int id_len;
+        const char *id = epdOperation(e->line, "id", &id_len);
+        if (id && id_len >= 2 && id[0] == '"' && id[id_len - 1] == '"')
         {
-            struct coordinate coord = {i, j};
-            putMoveset(coord);
+            id++;
+            id_len -= 2;
         }
-        else if (board[i][j].color != p.color)
+        if (id)
+            printf("%.*s: ", id_len, id);
+        else
+            printf("%d: ", i + 1);
+        if (!e->valid)
         {
-            struct coordinate coord = {i, j};
-            putMoveset(coord);
-            break;
+            invalid++;
+            printf("invalid position\n");
+            continue;
         }
-        else
+
+        char name[6] = "0000";
+        if (e->best)
+            moveToString(e->best, name);
+        printf("bestmove %s score %d depth %d nodes %llu", name, e->score, e->depth, (unsigned long long)e->nodes);
+        if (e->has_bm)
         {
-            break;
+            with_bm++;
+            solved += e->solved;
+            printf(" %s", e->solved ? "solved" : "not solved");
         }
+        printf("\n");
+        nodes += e->nodes;
     }
+
+    for (int t = 0; t < threads; t++)
+        pthread_join(workers[t], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    double seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("Positions: %d (%d invalid)", job.count, invalid);
+    if (with_bm)
+        printf(", solved %d of %d", solved, with_bm);
+    printf("\nNodes: %llu\n", (unsigned long long)nodes);
+    printf("Time: %.3f s (%.1f positions/s, %.0f nodes/s)\n", seconds,
+           seconds > 0 ? job.count / seconds : 0.0, seconds > 0 ? nodes / seconds : 0.0);
+
+    for (int i = 0; i < job.count; i++)
+        free(job.positions[i].line);
+    free(job.positions);
+    free(workers);
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.done_cond);
+    return 0;
 }
+/*---------------------- end epd -----------------------*/
 
-void moveKnight(struct coordinate move[])
-{
-    struct piece p = board[move[0].x][move[0].y];
+/*-------------------------- UCI --------------------------*/
 
-    if (move[0].x - 2 >= 0 && move[0].y - 1 >= 0)
-    {
-        if (board[move[0].x - 2][move[0].y - 1].color != p.color ||
-            board[move[0].x - 2][move[0].y - 1].recog == NONE)
-        {
-            struct coordinate coord = {move[0].x - 2, move[0].y - 1};
-            putMoveset(coord);
-        }
-    }
+// A UCI session. The main thread keeps reading commands while a search runs on
+// its own thread, so "stop" and "isready" are answered right away.
+struct uciSession
+{
+    struct GameState pos; // set by "position"
+    struct transTable tt;
+    int threads;
+    pthread_t thread;
+    bool searching;        // thread started and not joined yet
+    bool infinite;         // hold bestmove back until "stop"
+    atomic_bool stop;      // passed to the search as searchLimits.stop
+    atomic_bool stop_sent; // "stop" was received
+    struct searchLimits limits;
+    struct searchContext ctx;
+};
 
-    if (move[0].x - 2 >= 0 && move[0].y + 1 <= 7)
-    {
-        if (board[move[0].x - 2][move[0].y + 1].color != p.color ||
-            board[move[0].x - 2][move[0].y + 1].recog == NONE)
-        {
-            struct coordinate coord = {move[0].x - 2, move[0].y + 1};
-            putMoveset(coord);
-        }
-    }
+static struct uciSession uci;
 
-    if (move[0].x - 1 >= 0 && move[0].y + 2 <= 7)
-    {
-        if (board[move[0].x - 1][move[0].y + 2].color != p.color ||
-            board[move[0].x - 1][move[0].y + 2].recog == NONE)
-        {
-            struct coordinate coord = {move[0].x - 1, move[0].y + 2};
-            putMoveset(coord);
-        }
-    }
+void *uciSearch(void *arg)
+{
+    struct uciSession *s = arg;
+    Move best = searchBestMove(&s->ctx, &s->pos, &s->limits, &s->tt, s->threads);
+
+    // "go infinite" must not answer before "stop", even once the depth runs out
+    while (s->infinite && !atomic_load(&s->stop_sent))
+        usleep(1000);
+
+    char name[6] = "0000";
+    if (best)
+        moveToString(best, name);
+    printf("bestmove %s\n", name);
+    fflush(stdout);
+    return NULL;
+}
 
-    if (move[0].x - 1 >= 0 && move[0].y - 2 >= 0)
-    {
-        if (board[move[0].x - 1][move[0].y - 2].color != p.color ||
-            board[move[0].x - 1][move[0].y - 2].recog == NONE)
-        {
-            struct coordinate coord = {move[0].x - 1, move[0].y - 2};
-            putMoveset(coord);
-        }
-    }
+// End the running search, if any, and wait for its bestmove
+void uciStop(struct uciSession *s)
+{
+    if (!s->searching)
+        return;
+    atomic_store(&s->stop_sent, true);
+    atomic_store(&s->stop, true);
+    pthread_join(s->thread, NULL);
+    s->searching = false;
+}
 
-    if (move[0].x + 1 <= 7 && move[0].y + 2 <= 7)
+// "position startpos|fen <fen> [moves <move>...]"
+void uciPosition(struct uciSession *s, char *args)
+{
+    char *moves = strstr(args, "moves");
+    if (moves)
     {
-        if (board[move[0].x + 1][move[0].y + 2].color != p.color ||
-            board[move[0].x + 1][move[0].y + 2].recog == NONE)
-        {
-            struct coordinate coord = {move[0].x + 1, move[0].y + 2};
-            putMoveset(coord);
-        }
+        *moves = '\0';
+        moves += 5;
     }
 
-    if (move[0].x + 1 <= 7 && move[0].y - 2 >= 0)
+    if (strncmp(args, "fen", 3) == 0)
     {
-        if (board[move[0].x + 1][move[0].y - 2].color != p.color ||
-            board[move[0].x + 1][move[0].y - 2].recog == NONE)
+        if (loadFEN(&s->pos, args + 3 + strspn(args + 3, " ")) < 0)
         {
-            struct coordinate coord = {move[0].x + 1, move[0].y - 2};
-            putMoveset(coord);
+            printf("info string invalid fen\n");
+            loadFEN(&s->pos, START_FEN);
+            return;
         }
     }
+    else
+        loadFEN(&s->pos, START_FEN);
 
-    if (move[0].x + 2 <= 7 && move[0].y - 1 >= 0)
+    for (char *tok = moves ? strtok(moves, " \t") : NULL; tok; tok = strtok(NULL, " \t"))
     {
-        if (board[move[0].x + 2][move[0].y - 1].color != p.color ||
-            board[move[0].x + 2][move[0].y - 1].recog == NONE)
+        struct moveList legal;
+        generateLegal(&s->pos, &legal);
+        Move m = 0;
+        for (int i = 0; i < legal.count && !m; i++)
         {
-            struct coordinate coord = {move[0].x + 2, move[0].y - 1};
-            putMoveset(coord);
+            char name[6];
+            moveToString(legal.moves[i], name);
+            if (strcmp(name, tok) == 0)
+                m = legal.moves[i];
         }
-    }
-
-    if (move[0].x + 2 <= 7 && move[0].y + 1 <= 7)
-    {
-        if (board[move[0].x + 2][move[0].y + 1].color != p.color ||
-            board[move[0].x + 2][move[0].y + 1].recog == NONE)
+        if (!m)
         {
-            struct coordinate coord = {move[0].x + 2, move[0].y + 1};
-            putMoveset(coord);
+            printf("info string illegal move %s\n", tok);
+            return;
         }
+        commitMove(&s->pos, m);
     }
 }
 
-void moveRook(struct coordinate move[])
+// "go [depth N] [nodes N] [movetime MS] [wtime MS] [btime MS] [winc MS] [binc MS]
+// [movestogo N] [infinite] [ponder] [searchmoves <move>...]", without any limit it
+// searches until "stop"
+void uciGo(struct uciSession *s, char *args)
 {
-    struct piece p = board[move[0].x][move[0].y];
+    struct searchLimits limits = {0};
+    int time[2] = {0, 0}, inc[2] = {0, 0}; // by color
+    int movestogo = 0;
+    bool infinite = false;
 
-    // up
-    for (int i = move[0].x - 1; i >= 0; i--)
+    char *tok = strtok(args, " \t");
+    while (tok)
     {
-        if (board[i][move[0].y].recog == NONE)
+        // flags without a value
+        if (strcmp(tok, "infinite") == 0 || strcmp(tok, "ponder") == 0)
         {
-            struct coordinate coord = {i, move[0].y};
-            putMoveset(coord);
+            // no pondering: a ponder search is an ordinary one
+            infinite |= strcmp(tok, "infinite") == 0;
+            tok = strtok(NULL, " \t");
+            continue;
         }
-        else if (board[i][move[0].y].color != p.color)
+        // the root moves are not restricted, but the list must not be read as limits
+        if (strcmp(tok, "searchmoves") == 0)
         {
-            struct coordinate coord = {i, move[0].y};
-            putMoveset(coord);
-            break;
+            do
+                tok = strtok(NULL, " \t");
+            while (tok && tok[0] >= 'a' && tok[0] <= 'h' && tok[1] >= '1' && tok[1] <= '8');
+            continue;
         }
-        else
-        {
+
+        char *val = strtok(NULL, " \t");
+        if (!val)
             break;
-        }
+        int n = atoi(val);
+        if (strcmp(tok, "depth") == 0)
+            limits.depth = n;
+        else if (strcmp(tok, "nodes") == 0)
+            limits.nodes = strtoull(val, NULL, 10);
+        else if (strcmp(tok, "movetime") == 0)
+            limits.movetime_ms = n;
+        else if (strcmp(tok, "wtime") == 0)
+            time[1] = n;
+        else if (strcmp(tok, "btime") == 0)
+            time[0] = n;
+        else if (strcmp(tok, "winc") == 0)
+            inc[1] = n;
+        else if (strcmp(tok, "binc") == 0)
+            inc[0] = n;
+        else if (strcmp(tok, "movestogo") == 0)
+            movestogo = n;
+        tok = strtok(NULL, " \t");
     }
 
-    // down
-    for (int i = move[0].x + 1; i <= 7; i++)
+    // spread the clock over the moves still to play, keeping a margin for overhead
+    int side = s->pos.side;
+    if (!infinite && !limits.movetime_ms && time[side] > 0)
     {
-        if (board[i][move[0].y].recog == NONE)
-        {
-            struct coordinate coord = {i, move[0].y};
-            putMoveset(coord);
-        }
-        else if (board[i][move[0].y].color != p.color)
-        {
-            struct coordinate coord = {i, move[0].y};
-            putMoveset(coord);
-            break;
-        }
-        else
-        {
-            break;
-        }
+        int budget = time[side] / (movestogo > 0 ? movestogo + 1 : 30) + inc[side] * 3 / 4;
+        if (budget > time[side] - 50)
+            budget = time[side] - 50;
+        limits.movetime_ms = budget > 1 ? budget : 1;
     }
-
-    // right (scan along columns; i is column index)
-    for (int i = move[0].y + 1; i <= 7; i++)
+    if (infinite)
     {
-        if (board[move[0].x][i].recog == NONE)
-        {
-            struct coordinate coord = {move[0].x, i};
-            putMoveset(coord);
-        }
-        else if (board[move[0].x][i].color != p.color)
-        {
-            struct coordinate coord = {move[0].x, i};
-            putMoveset(coord);
-            break;
-        }
-        else
-        {
-            break;
-        }
+        limits.depth = limits.movetime_ms = 0;
+        limits.nodes = 0;
     }
+    else if (!limits.depth && !limits.movetime_ms && !limits.nodes)
+        infinite = true;
+
+    limits.stop = &s->stop;
+    limits.info = true;
+    s->limits = limits;
+    s->infinite = infinite;
+    atomic_store(&s->stop, false);
+    atomic_store(&s->stop_sent, false);
+    s->searching = pthread_create(&s->thread, NULL, uciSearch, s) == 0;
+}
+
+// "setoption name Hash|Threads value N", or one of the search_options switches
+// with "value true|false"
+void uciSetOption(struct uciSession *s, char *args)
+{
+    char name[32], text[16];
+    if (sscanf(args, "name %31s value %15s", name, text) != 2)
+        return;
+    int value = atoi(text);
+    bool on = strcasecmp(text, "true") == 0;
 
-    // left (scan along columns leftwards)
-    for (int i = move[0].y - 1; i >= 0; i--)
+    if (strcasecmp(name, "Hash") == 0 && value > 0)
     {
-        if (board[move[0].x][i].recog == NONE)
-        {
-            struct coordinate coord = {move[0].x, i};
-            putMoveset(coord);
-        }
-        else if (board[move[0].x][i].color != p.color)
-        {
-            struct coordinate coord = {move[0].x, i};
-            putMoveset(coord);
-            break;
-        }
-        else
-        {
-            break;
-        }
+        freeTransTable(&s->tt);
+        initTransTable(&s->tt, value);
     }
+    else if (strcasecmp(name, "Threads") == 0 && value > 0)
+        s->threads = value;
+    else if (strcasecmp(name, "NullMove") == 0)
+        search_options.null_move = on;
+    else if (strcasecmp(name, "LMR") == 0)
+        search_options.lmr = on;
+    else if (strcasecmp(name, "PVS") == 0)
+        search_options.pvs = on;
+    else if (strcasecmp(name, "Aspiration") == 0)
+        search_options.aspiration = on;
+    else if (strcasecmp(name, "Futility") == 0)
+        search_options.futility = on;
+}
+
+// True when line starts with the word cmd; args then points past it
+static bool isCommand(char *line, const char *cmd, char **args)
+{
+    size_t n = strlen(cmd);
+    if (strncmp(line, cmd, n) != 0 || (line[n] && line[n] != ' ' && line[n] != '\t'))
+        return false;
+    *args = line + n + strspn(line + n, " \t");
+    return true;
 }
 
-void movePawn(struct coordinate move[], bool AMCall)
+// Talk UCI on stdin/stdout until "quit" or the end of input
+int runUci()
 {
-    struct piece p = board[move[0].x][move[0].y];
-    int row = move[0].x;
-    int col = move[0].y;
+    init(&uci.pos);
+    uci.threads = 1;
+    initTransTable(&uci.tt, 16);
 
-    // When generating attack map, pawns attack diagonals regardless of occupancy.
-    if (AMCall)
+    char *line = NULL;
+    size_t cap = 0;
+    while (getline(&line, &cap, stdin) >= 0)
     {
-        if (p.color == 0) // black pawn attacks down (higher row index)
+        line[strcspn(line, "\r\n")] = '\0';
+        char *cmd = line + strspn(line, " \t");
+        char *args;
+
+        if (isCommand(cmd, "uci", &args))
         {
-            if (row + 1 <= 7 && col - 1 >= 0) putMoveset((struct coordinate){row + 1, col - 1});
-            if (row + 1 <= 7 && col + 1 <= 7) putMoveset((struct coordinate){row + 1, col + 1});
+            printf("id name Chess\n");
+            printf("id author Chess Game in C contributors\n");
+            printf("option name Hash type spin default 16 min 1 max 65536\n");
+            printf("option name Threads type spin default 1 min 1 max 256\n");
+            printf("option name NullMove type check default true\n");
+            printf("option name LMR type check default true\n");
+            printf("option name PVS type check default true\n");
+            printf("option name Aspiration type check default true\n");
+            printf("option name Futility type check default true\n");
+            printf("uciok\n");
         }
-        else // white pawn attacks up (lower row index)
+        else if (isCommand(cmd, "isready", &args))
+            printf("readyok\n");
+        else if (isCommand(cmd, "ucinewgame", &args))
         {
-            if (row - 1 >= 0 && col - 1 >= 0) putMoveset((struct coordinate){row - 1, col - 1});
-            if (row - 1 >= 0 && col + 1 <= 7) putMoveset((struct coordinate){row - 1, col + 1});
+            uciStop(&uci);
+            clearTransTable(&uci.tt);
         }
-        return;
-    }
-
-    // Normal move generation (non-AMCall)
-    if (p.color == 0)
-    {
-        // two-square move: check both intermediate and target squares
-        if (p.moved == 0)
+        else if (isCommand(cmd, "position", &args))
         {
-            if (row + 2 <= 7 && board[row + 1][col].recog == NONE && board[row + 2][col].recog == NONE)
-                putMoveset((struct coordinate){row + 2, col});
+            uciStop(&uci);
+            uciPosition(&uci, args);
         }
-        // one-square forward
-        if (row + 1 <= 7 && board[row + 1][col].recog == NONE)
-            putMoveset((struct coordinate){row + 1, col});
-
-        // captures (diagonals)
-        if (row + 1 <= 7 && col + 1 <= 7 && board[row + 1][col + 1].recog != NONE && board[row + 1][col + 1].color != p.color)
-            putMoveset((struct coordinate){row + 1, col + 1});
-        if (row + 1 <= 7 && col - 1 >= 0 && board[row + 1][col - 1].recog != NONE && board[row + 1][col - 1].color != p.color)
-            putMoveset((struct coordinate){row + 1, col - 1});
-
-        // en-passant captures
-        if (row + 1 <= 7 && col - 1 >= 0)
+        else if (isCommand(cmd, "go", &args))
         {
-            struct piece maybe = board[row][col - 1];
-            if ((maybe.recog == WP || maybe.recog == BP) && maybe.color != p.color && maybe.doubleMove == 1)
-                putMoveset((struct coordinate){row + 1, col - 1});
+            uciStop(&uci);
+            uciGo(&uci, args);
         }
-        if (row + 1 <= 7 && col + 1 <= 7)
+        else if (isCommand(cmd, "stop", &args))
+            uciStop(&uci);
+        else if (isCommand(cmd, "setoption", &args))
         {
-            struct piece maybe = board[row][col + 1];
-            if ((maybe.recog == WP || maybe.recog == BP) && maybe.color != p.color && maybe.doubleMove == 1)
-                putMoveset((struct coordinate){row + 1, col + 1});
+            uciStop(&uci);
+            uciSetOption(&uci, args);
         }
+        else if (isCommand(cmd, "quit", &args))
+            break;
+        fflush(stdout);
     }
-    else
-    {
-        // white pawns
-        if (p.moved == 0)
-        {
-            if (row - 2 >= 0 && board[row - 1][col].recog == NONE && board[row - 2][col].recog == NONE)
-                putMoveset((struct coordinate){row - 2, col});
-        }
-        if (row - 1 >= 0 && board[row - 1][col].recog == NONE)
-            putMoveset((struct coordinate){row - 1, col});
 
-        if (row - 1 >= 0 && col - 1 >= 0 && board[row - 1][col - 1].recog != NONE && board[row - 1][col - 1].color != p.color)
-            putMoveset((struct coordinate){row - 1, col - 1});
-        if (row - 1 >= 0 && col + 1 <= 7 && board[row - 1][col + 1].recog != NONE && board[row - 1][col + 1].color != p.color)
-            putMoveset((struct coordinate){row - 1, col + 1});
+    uciStop(&uci);
+    free(line);
+    freeTransTable(&uci.tt);
+    return 0;
+}
+/*---------------------- end uci -----------------------*/
 
-        if (row - 1 >= 0 && col - 1 >= 0)
-        {
-            struct piece maybe = board[row][col - 1];
-            if ((maybe.recog == WP || maybe.recog == BP) && maybe.color != p.color && maybe.doubleMove == 1)
-                putMoveset((struct coordinate){row - 1, col - 1});
+// Main code
+int main(int argc, char *argv[])
+{
+    // precompute attack tables and hash keys
+    initSliderAttacks();
+    initLeaperAttacks();
+    initZobrist();
+    initEval();
+
+    // "perft <depth> [fen] [--threads N] [--hash MB]" (or "divide ...") benchmarks
+    // the move generator without a window
+    if (argc >= 3 && (strcmp(argv[1], "perft") == 0 || strcmp(argv[1], "divide") == 0))
+    {
+        const char *fen = START_FEN;
+        int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        int hash_mb = 0;
+        for (int i = 3; i < argc; i++)
+        {
+            if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+                threads = atoi(argv[++i]);
+            else if (strcmp(argv[i], "--hash") == 0 && i + 1 < argc)
+                hash_mb = atoi(argv[++i]);
+            else
+                fen = argv[i];
         }
-        if (row - 1 >= 0 && col + 1 <= 7)
+        char *depth_end;
+        long depth = strtol(argv[2], &depth_end, 10);
+        if (depth_end == argv[2] || *depth_end || depth < 0 || depth > MAX_PLY)
         {
-            struct piece maybe = board[row][col + 1];
-            if ((maybe.recog == WP || maybe.recog == BP) && maybe.color != p.color && maybe.doubleMove == 1)
-                putMoveset((struct coordinate){row - 1, col + 1});
+            printf("Invalid depth: %s\n", argv[2]);
+            return 1;
         }
+        return runPerft((int)depth, fen, strcmp(argv[1], "divide") == 0, threads, hash_mb);
     }
-}
-/*-----------------------------------------------------------------*/
 
-/* Make the move after checking legality of the move
-   take move input in format e3b4 */
-void input(char turn, struct coordinate move[2])
-{
-    char coords[5];
-    printf("Enter move for %c: ", turn);
-    scanf("%4s", coords);
-    
-    convertToCoord(coords, move);
-}
- 
-void convertToCoord(char coord[], struct coordinate move[])
-{
-    // accept "cr" or "cl" as castle commands
-    if (coord[0] == 'c' && coord[1] == 'r' && coord[2] == '\0')
+    // "pgn <file> [--threads N]" checks and replays every game of a PGN file
+    if (argc >= 3 && strcmp(argv[1], "pgn") == 0)
     {
-        move[0] = (struct coordinate){-2, 0};
-        move[1] = (struct coordinate){-2, 0};
-        return;
+        int threads = 1;
+        for (int i = 3; i < argc; i++)
+            if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+                threads = atoi(argv[++i]);
+        return runPgn(argv[2], threads);
     }
-    if (coord[0] == 'c' && coord[1] == 'l' && coord[2] == '\0')
+
+    // "epd <file> [--depth N] [--nodes N] [--threads N] [--hash MB]" searches every
+    // position of an EPD file, by default to depth 8 on all cores with 1 MB of
+    // hash per thread
+    if (argc >= 3 && strcmp(argv[1], "epd") == 0)
     {
-        move[0] = (struct coordinate){-3, 0};
-        move[1] = (struct coordinate){-3, 0};
-        return;
+        struct searchLimits limits = {0};
+        int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        int hash_mb = 1;
+        for (int i = 3; i < argc; i++)
+        {
+            if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc)
+                limits.depth = atoi(argv[++i]);
+            else if (strcmp(argv[i], "--nodes") == 0 && i + 1 < argc)
+                limits.nodes = strtoull(argv[++i], NULL, 10);
+            else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+                threads = atoi(argv[++i]);
+            else if (strcmp(argv[i], "--hash") == 0 && i + 1 < argc)
+                hash_mb = atoi(argv[++i]);
+            else
+                parseSearchOption(argv[i]);
+        }
+        if (limits.depth <= 0 && !limits.nodes)
+            limits.depth = 8;
+        return runEpd(argv[2], &limits, threads, hash_mb);
     }
- 
-     // expecting input like "a8a6"
-     int col1 = coord[0] - 'a';       
-     int row1 = 8 - (coord[1] - '0'); 
- 
-     int col2 = coord[2] - 'a';
-     int row2 = 8 - (coord[3] - '0');
- 
-     if (0 <= col1 && col1 < 8 && 0 <= col2 && col2 < 8 &&
-         0 <= row1 && row1 < 8 && 0 <= row2 && row2 < 8)
-     {
-
-         printf("%d %d %d %d\n", row1, col1, row2, col2);
-
-         move[0] = (struct coordinate){row1, col1}; // (row, col)
-         move[1] = (struct coordinate){row2, col2};
-         return;
-     }
-
-     printf("Coordinate conversion error\n");
- }
-
-/*-------------------------- CASTLING HELPERS --------------------------*/
-
-bool canCastle(int color, char side)
-{
-    // find king
-    int king_row = -1, king_col = -1;
-    for (int r = 0; r < 8; r++)
-        for (int c = 0; c < 8; c++)
-            if ((color == 1 && board[r][c].recog == WK) || (color == 0 && board[r][c].recog == BK))
-            {
-                king_row = r;
-                king_col = c;
-                break;
-            }
-    if (king_row == -1) return false;
 
-    struct piece king = board[king_row][king_col];
-    if (king.moved) return false; // king already moved
-
-    int rook_col = (side == 'r') ? 7 : 0;
-    struct piece rook = board[king_row][rook_col];
-    // rook must exist, be same color, and unmoved
-    if ( (color == 1 && rook.recog != WR) || (color == 0 && rook.recog != BR) ) return false;
-    if (rook.moved) return false;
-
-    // squares between king and rook must be empty
-    int from = (king_col < rook_col) ? king_col : rook_col;
-    int to = (king_col < rook_col) ? rook_col : king_col;
-    for (int c = from + 1; c < to; c++)
-        if (board[king_row][c].recog != NONE) return false;
-
-    // squares king traverses must not be under attack and king must not be in check
-    int dir = (side == 'r') ? 1 : -1;
-    memset(attack_map, 0, sizeof(attack_map));
-    clearMoveset();
-    struct coordinate dummy[2] = {{0,0},{0,0}};
-    generateAM(dummy, !color);
-
-    if (attack_map[king_row][king_col]) return false;
-    int pass_col = king_col + dir;
-    if (pass_col < 0 || pass_col > 7) return false;
-    if (attack_map[king_row][pass_col]) return false;
-    int dest_col = king_col + 2 * dir;
-    if (dest_col < 0 || dest_col > 7) return false;
-    if (attack_map[king_row][dest_col]) return false;
-
-    clearMoveset();
-    return true;
-}
-
-// Perform castle on board (assumes legality checked). Updates moved flags.
-void doCastle(int color, char side)
-{
-    // find king
-    int king_row = -1, king_col = -1;
-    for (int r = 0; r < 8; r++)
-        for (int c = 0; c < 8; c++)
-            if ((color == 1 && board[r][c].recog == WK) || (color == 0 && board[r][c].recog == BK))
+    // "uci" speaks the UCI protocol on stdin/stdout instead of opening a window
+    if (argc >= 2 && strcmp(argv[1], "uci") == 0)
+        return runUci();
+
+    // Initialize the chess board before the input thread starts reading it
+    struct game game = {0};
+    init(&game.pos);
+
+    // "--engine w|b|wb" lets the engine play those sides, each move limited by
+    // "--depth N" plies and/or "--movetime MS" (one second per move by default).
+    // "--hash MB" sizes its transposition table, shared by "--threads N" search threads.
+    // "--fen <fen>" starts the game from that position instead of the initial one.
+    int hash_mb = 16;
+    game.threads = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc)
+        {
+            i++;
+            game.engine[1] = strchr(argv[i], 'w') != NULL;
+            game.engine[0] = strchr(argv[i], 'b') != NULL;
+        }
+        else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc)
+            game.limits.depth = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--movetime") == 0 && i + 1 < argc)
+            game.limits.movetime_ms = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--hash") == 0 && i + 1 < argc)
+            hash_mb = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            game.threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--fen") == 0 && i + 1 < argc)
+        {
+            if (loadFEN(&game.pos, argv[++i]) < 0)
             {
-                king_row = r;
-                king_col = c;
-                break;
+                printf("Invalid FEN: %s\n", argv[i]);
+                return 1;
             }
-    if (king_row == -1) return;
-
-    int dir = (side == 'r') ? 1 : -1;
-    int rook_col = (side == 'r') ? 7 : 0;
-
-    // new king position and rook position
-    int new_king_col = king_col + 2 * dir;
-    int new_rook_col = king_col + dir;
-
-    board[king_row][new_king_col] = board[king_row][king_col];
-    board[king_row][new_king_col].coord.x = king_row;
-    board[king_row][new_king_col].coord.y = new_king_col;
-    board[king_row][new_king_col].moved = 1;
-
-    board[king_row][king_col] = (struct piece){{king_row, king_col}, NONE, 0, 0, 0, 0};
-
-    board[king_row][new_rook_col] = board[king_row][rook_col];
-    board[king_row][new_rook_col].coord.x = king_row;
-    board[king_row][new_rook_col].coord.y = new_rook_col;
-    board[king_row][new_rook_col].moved = 1;
-
-    board[king_row][rook_col] = (struct piece){{king_row, rook_col}, NONE, 0, 0, 0, 0};
-}
-/*---------------------- end castling helpers -----------------------*/
-
-// Main code
-int main()
-{
-
+        }
+        else
+            parseSearchOption(argv[i]);
+    }
+    if (hash_mb > 0)
+        initTransTable(&game.tt, hash_mb);
+    if (game.limits.depth <= 0 && game.limits.movetime_ms <= 0)
+        game.limits.movetime_ms = 1000;
+
+#ifdef HEADLESS
+    // nothing to draw: play the game on this thread
+    run(&game);
+    freeTransTable(&game.tt);
+    return 0;
+#else
     // Create seperate thread for the terminal input function
     pthread_t inputThread;
-    pthread_create(&inputThread, NULL, run, NULL);
+    pthread_create(&inputThread, NULL, run, &game);
 
     // Initialize SDL and SDL_image
     SDL_Init(SDL_INIT_VIDEO);
@@ -1347,9 +3883,6 @@ int main()
                                           WINDOW_SIZE, WINDOW_SIZE, 0);
     SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, 0);
 
-    // Initialize the chess board
-    init();
-
     // load png images
     loadImagesPNG(renderer);
 
@@ -1375,7 +3908,7 @@ int main()
         SDL_RenderClear(renderer);
 
         // Draw chessboard squares and pieces
-        drawChessBoard(renderer);
+        drawChessBoard(renderer, &game.pos);
 
         // Display window
         SDL_RenderPresent(renderer);
@@ -1384,6 +3917,8 @@ int main()
 
     // Exit
     cleanup(renderer, window);
+    freeTransTable(&game.tt);
 
     return 0;
+#endif
 }